@@ -40,6 +40,287 @@ else
 	echo "hw/i386/acpi-build.c 文件处理完成（第一次处理，只处理一次）"
 fi
 
+sed -i '/"etc\/smbios\/smbios-tables",$/{N;s/fw_cfg_add_file(fw_cfg, "etc\/smbios\/smbios-tables",\n\( *\)smbios_tables, smbios_tables_len);/fw_cfg_add_file_callback(fw_cfg, "etc\/smbios\/smbios-tables",\n\1smbios_fw_cfg_select, NULL, NULL,\n\1smbios_tables, smbios_tables_len, true);/}' hw/i386/fw_cfg.c
+
+grep "query-smbios" qapi/machine.json >/dev/null
+if [ $? -eq 0 ]; then
+	echo "qapi/machine.json 文件只能处理一次！以前已经处理，本次不执行！"
+else
+	cat >> qapi/machine.json << 'EOF'
+
+##
+# @SmbiosStructureInfo:
+#
+# One structure of the SMBIOS tables.
+#
+# @type: structure type
+#
+# @handle: structure handle
+#
+# @length: length of the formatted area
+#
+# @strings: number of strings in the string-set
+#
+# Since: 9.0
+##
+{ 'struct': 'SmbiosStructureInfo',
+  'data': { 'type': 'uint8', 'handle': 'uint16', 'length': 'uint8',
+            'strings': 'uint32' } }
+
+##
+# @SmbiosPartInfo:
+#
+# Cost of one group of structures in the last build.
+#
+# @name: group name
+#
+# @types: structure types of the group, e.g. "16-20"
+#
+# @reused: the structures were copied from the previous build
+#
+# @build-time: time spent on the group, in microseconds
+#
+# @allocations: table blob (re)allocations while building the group
+#
+# Since: 9.0
+##
+{ 'struct': 'SmbiosPartInfo',
+  'data': { 'name': 'str', 'types': 'str', 'reused': 'bool',
+            'build-time': 'int', 'allocations': 'uint32' } }
+
+##
+# @SmbiosTypeInfo:
+#
+# Cost of the structures of one type in the last build.
+#
+# @type: structure type
+#
+# @structures: structures of the type built; those copied from the
+#     previous build are not counted
+#
+# @build-time-ns: time spent building them, in nanoseconds
+#
+# @allocations: table blob (re)allocations while building them
+#
+# Since: 9.0
+##
+{ 'struct': 'SmbiosTypeInfo',
+  'data': { 'type': 'uint8', 'structures': 'uint32',
+            'build-time-ns': 'int', 'allocations': 'uint32' } }
+
+##
+# @SmbiosInfo:
+#
+# The SMBIOS tables given to the guest, and what building them cost.
+#
+# @tables-length: size of the tables blob
+#
+# @entry-point: entry point type used, never @auto
+#
+# @auto-fallback: @auto was asked for and the tables did not fit the
+#     2.1 entry point
+#
+# @build-time: time spent building the tables, in microseconds
+#
+# @allocations: table blob (re)allocations
+#
+# @cache-hit: the tables were read from the -smbios cache-dir
+#
+# @shared: the tables are mapped from the -smbios share-dir
+#
+# @structures: the structures, in table order
+#
+# @parts: the structure groups built; empty for tables read from the
+#     cache or received on migration
+#
+# @types: the structure types built, by type; empty for tables read
+#     from the cache or received on migration
+#
+# Since: 9.0
+##
+{ 'struct': 'SmbiosInfo',
+  'data': { 'tables-length': 'size',
+            'entry-point': 'SmbiosEntryPointType',
+            'auto-fallback': 'bool', 'build-time': 'int',
+            'allocations': 'uint32', 'cache-hit': 'bool', 'shared': 'bool',
+            'structures': ['SmbiosStructureInfo'],
+            'parts': ['SmbiosPartInfo'],
+            'types': ['SmbiosTypeInfo'] } }
+
+##
+# @query-smbios:
+#
+# Return the SMBIOS tables of the guest and the cost of building them.
+#
+# Returns: @SmbiosInfo
+#
+# Errors:
+#     - If the tables have not been built yet
+#
+# Since: 9.0
+#
+# Example:
+#
+#     -> { "execute": "query-smbios" }
+#     <- { "return": { "tables-length": 1521, "entry-point": "32",
+#                      "auto-fallback": false, "build-time": 104,
+#                      "allocations": 1, "cache-hit": false,
+#                      "shared": false,
+#                      "structures": [ { "type": 0, "handle": 0,
+#                                        "length": 26, "strings": 3 },
+#                                      ... ],
+#                      "parts": [ { "name": "system", "types": "0-3",
+#                                   "reused": false, "build-time": 12,
+#                                   "allocations": 0 },
+#                                 ... ],
+#                      "types": [ { "type": 0, "structures": 1,
+#                                   "build-time-ns": 1850,
+#                                   "allocations": 1 },
+#                                 ... ] } }
+##
+{ 'command': 'query-smbios', 'returns': 'SmbiosInfo' }
+EOF
+	cat >> hw/smbios/smbios-stub.c << 'EOF'
+
+#include "qapi/qapi-commands-machine.h"
+
+SmbiosInfo *qmp_query_smbios(Error **errp)
+{
+    error_setg(errp, "This machine does not support SMBIOS");
+    return NULL;
+}
+EOF
+	echo "qapi/machine.json 文件处理完成（第一次处理，只处理一次）"
+fi
+
+grep "set-smbios" qapi/machine.json >/dev/null
+if [ $? -eq 0 ]; then
+	echo "qapi/machine.json（set-smbios）文件只能处理一次！以前已经处理，本次不执行！"
+else
+	cat >> qapi/machine.json << 'EOF'
+
+##
+# @set-smbios:
+#
+# Change fields of the SMBIOS BIOS, system, baseboard or chassis
+# information structures (types 0 to 3).  Firmware reads the tables
+# at boot, so the change is staged and applied when the tables are
+# rebuilt at the next system reset, together with the processor and
+# memory structures of CPUs and DIMMs plugged or unplugged since.
+# Staged changes are not migrated.
+#
+# @options: the fields, in -smbios syntax, e.g. "type=0,uefi=on"
+#
+# Errors:
+#     - If @options sets anything but fields of types 0 to 3, or
+#       sets the UUID
+#     - If the machine's SMBIOS tables can't be rebuilt
+#
+# Since: 9.0
+#
+# Example:
+#
+#     -> { "execute": "set-smbios",
+#          "arguments": { "options": "type=0,release=5.9" } }
+#     <- { "return": {} }
+##
+{ 'command': 'set-smbios', 'data': { 'options': 'str' } }
+EOF
+	cat >> hw/smbios/smbios-stub.c << 'EOF'
+
+void qmp_set_smbios(const char *options, Error **errp)
+{
+    error_setg(errp, "This machine does not support SMBIOS");
+}
+EOF
+	echo "qapi/machine.json（set-smbios）文件处理完成（第一次处理，只处理一次）"
+fi
+
+#内存条、CPU 热插拔后通知 smbios.c，下次重启时重建 type 4/16/17/19/20 表
+grep "smbios_device_plug" hw/i386/pc.c >/dev/null
+if [ $? -eq 0 ]; then
+	echo "hw/i386/pc.c（热插拔）文件只能处理一次！以前已经处理，本次不执行！"
+else
+	X86_CPU_PLUG_C=$(grep -l "found_cpu->cpu = CPU(dev);" hw/i386/*.c)
+	for f in hw/i386/pc.c $X86_CPU_PLUG_C; do
+		grep '#include "hw/firmware/smbios.h"' $f >/dev/null || \
+			sed -i '0,/^#include "hw\//s//#include "hw\/firmware\/smbios.h"\n&/' $f
+	done
+	sed -i 's/^    pc_dimm_plug(PC_DIMM(dev), MACHINE(pcms));$/&\n    smbios_device_plug(dev);/' hw/i386/pc.c
+	sed -i 's/^    pc_dimm_unplug(PC_DIMM(dev), MACHINE(pcms));$/    smbios_device_unplug(dev);\n&/' hw/i386/pc.c
+	sed -i 's/^    found_cpu->cpu = CPU(dev);$/&\n    smbios_device_plug(dev);/' $X86_CPU_PLUG_C
+	sed -i '/^void x86_cpu_unplug_cb/,/^}/s/^    found_cpu->cpu = NULL;$/&\n    smbios_device_unplug(dev);/' $X86_CPU_PLUG_C
+	cat >> hw/smbios/smbios-stub.c << 'EOF'
+
+void smbios_device_plug(DeviceState *dev)
+{
+}
+
+void smbios_device_unplug(DeviceState *dev)
+{
+}
+EOF
+	echo "hw/i386/pc.c（热插拔）文件处理完成（第一次处理，只处理一次）"
+fi
+
+#smbios_build.h 的 SMBIOS_BUILD_TABLE_PRE 多了 instance 参数（跟踪用），IPMI 的 type 38 表也要跟着改
+sed -i 's/SMBIOS_BUILD_TABLE_PRE(38, *\([^,]*\), *true)/SMBIOS_BUILD_TABLE_PRE(38, \1, 0, true)/' hw/smbios/smbios_type_38.c
+
+grep "'hw/smbios'" meson.build >/dev/null
+if [ $? -eq 0 ]; then
+	echo "meson.build 文件只能处理一次！以前已经处理，本次不执行！"
+else
+	sed -i "s/^    'hw\/sparc',$/    'hw\/smbios',\n    'hw\/sparc',/" meson.build
+	cat > hw/smbios/trace.h << 'EOF'
+#include "trace/trace-hw_smbios.h"
+EOF
+	cat > hw/smbios/trace-events << 'EOF'
+# See docs/devel/tracing.rst for syntax documentation.
+
+# smbios.c
+smbios_build_begin(int ep_type, unsigned sockets, uint64_t ram_size) "ep_type %d sockets %u ram_size 0x%" PRIx64
+smbios_build_end(int ep_type, size_t tables_len, unsigned structures, bool cache_hit, int64_t us) "ep_type %d tables_len %zu structures %u cache_hit %d took %" PRId64 " us"
+smbios_handle(uint8_t type, unsigned instance, uint16_t handle) "type %u instance %u handle 0x%04x"
+smbios_table_begin(uint8_t type, unsigned instance, uint16_t handle) "type %u instance %u handle 0x%04x"
+smbios_table_end(uint8_t type, unsigned instance, uint16_t handle, size_t bytes) "type %u instance %u handle 0x%04x bytes %zu"
+smbios_table_image(uint8_t type, unsigned instance, uint16_t handle, size_t bytes) "type %u instance %u handle 0x%04x bytes %zu"
+smbios_table_clone(uint8_t type, unsigned instance, uint16_t handle, size_t bytes) "type %u instance %u handle 0x%04x bytes %zu"
+smbios_part_reuse(const char *part, unsigned structures, size_t bytes) "%s structures %u bytes %zu"
+smbios_entry_point_setup_begin(int ep_type, size_t tables_len) "ep_type %d tables_len %zu"
+smbios_entry_point_setup_end(int ep_type, size_t anchor_len) "ep_type %d anchor_len %zu"
+EOF
+	echo "meson.build 文件处理完成（第一次处理，只处理一次）"
+fi
+
+#contrib/smbios 是 SMBIOS 工具（smbios-fleet、smbios-build-bench），源文件和本脚本放在一起，或者用 SMBIOS_TOOLS_DIR 指定目录
+SMBIOS_TOOLS_DIR=${SMBIOS_TOOLS_DIR:-$(dirname "$0")}
+mkdir -p contrib/smbios
+cp "$SMBIOS_TOOLS_DIR"/smbios-tools-stubs.c "$SMBIOS_TOOLS_DIR"/smbios-fleet.c \
+	"$SMBIOS_TOOLS_DIR"/smbios-build-bench.c contrib/smbios/
+cat > contrib/smbios/meson.build << 'EOF'
+# hw/smbios/smbios.c without the system emulator, for SmbiosBuilder users
+libsmbios_tools = static_library('smbios-tools',
+                                 files('../../hw/smbios/smbios.c',
+                                       'smbios-tools-stubs.c') + genh,
+                                 dependencies: [qemuutil, qom],
+                                 build_by_default: false)
+smbios_tools = declare_dependency(link_with: libsmbios_tools,
+                                  dependencies: [qemuutil, qom])
+
+executable('smbios-fleet', files('smbios-fleet.c'),
+           dependencies: smbios_tools,
+           install: true)
+executable('smbios-build-bench', files('smbios-build-bench.c'),
+           dependencies: smbios_tools)
+EOF
+grep "contrib/smbios" meson.build >/dev/null
+if [ $? -eq 0 ]; then
+	echo "contrib/smbios 文件只能处理一次！以前已经处理，本次不执行！"
+else
+	sed -i "s/^  executable('qemu-edid',/  subdir('contrib\/smbios')\n\n&/" meson.build
+	echo "contrib/smbios 文件处理完成（第一次处理，只处理一次）"
+fi
+
 sed -i 's/"QEMU/"ASUS/g' hw/i386/pc_piix.c
 sed -i 's/Standard PC (i440FX + PIIX, 1996)/ASUS M4A88TD-Mi440fx/g' hw/i386/pc_piix.c
 sed -i 's/"QEMU/"ASUS/g' hw/i386/pc_q35.c
@@ -0,0 +1,326 @@
+#!/bin/bash
+#
+# SMBIOS startup benchmark
+#
+# Starts the patched QEMU over a matrix of machine types, topologies,
+# memory sizes and -smbios options and measures, for each, the time from
+# process start until the SMBIOS fw_cfg files have been read, and QEMU's
+# resident memory at that point. No guest OS or firmware is involved:
+# QEMU runs with the qtest accelerator and this script reads
+# etc/smbios/smbios-anchor and etc/smbios/smbios-tables itself, over
+# fw_cfg DMA, the way the firmware would.
+#
+# Each configuration has a time budget. A configuration whose median
+# over the runs exceeds it FAILs, and the script then exits with 1, so
+# that it can gate changes to smbios.c. After the matrix, q35-bridge-bus
+# checks that the bus number of a device behind a PCIe root port makes
+# it into the tables, see bus_check().
+#
+# Usage: smbios-bench.sh [-q QEMU] [-r RUNS] [MATRIX]
+#
+# MATRIX holds one configuration per line, '#' starts a comment:
+#
+#   NAME  BUDGET-MS  MACHINE  SMP  MEMORY  [SMBIOS-OPTION...]
+#
+# Each SMBIOS-OPTION is passed as one '-smbios' argument. Without
+# MATRIX, the built-in matrix below is used. Memory is not reserved, so
+# large guests fit on a small host. The CPU gets 46 physical address
+# bits (64 TiB), as the default 40 do not cover the larger guests.
+# QEMU only starts with more than 255 APIC IDs with KVM's x2APIC, so
+# keep SMP below that. A configuration QEMU doesn't start for shows as
+# ERROR, with the first line QEMU printed to stderr below it.
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or
+# (at your option) any later version.
+
+QEMU=qemu-system-x86_64
+RUNS=5
+
+DEFAULT_MATRIX='
+# name          budget-ms machine smp               memory  smbios options
+q35-1s-2g       300       q35     1                 2G
+q35-4s-64g      300       q35     32,sockets=4      64G
+q35-8s-1t       400       q35     240,sockets=8     1T
+q35-64s-4t      600       q35     128,sockets=64    4T
+q35-4s-oem      300       q35     32,sockets=4      64G     type=11,value=bench-oem-1,value=bench-oem-2
+q35-4s-dimm     300       q35     32,sockets=4      64G     type=17,dimm-size=8G
+q35-4s-lazy     300       q35     32,sockets=4      64G     lazy=on
+pc-1s-2g        300       pc      1                 2G
+pc-4s-64g       300       pc      32,sockets=4      64G
+'
+
+# fw_cfg I/O ports and DMA control bits, see docs/specs/fw_cfg.rst
+FW_CFG_DMA_ADDR_HIGH=0x514
+FW_CFG_DMA_ADDR_LOW=0x518
+FW_CFG_FILE_DIR=0x19
+FW_CFG_DMA_CTL_READ=0x02
+FW_CFG_DMA_CTL_SELECT=0x08
+
+# guest physical addresses of the DMA descriptor and buffer
+DMA_DESC=0x1000
+DMA_BUF=0x100000
+
+usage() {
+	echo "Usage: $0 [-q QEMU] [-r RUNS] [MATRIX]" >&2
+	exit 2
+}
+
+while getopts "q:r:h" opt; do
+	case $opt in
+	q) QEMU=$OPTARG ;;
+	r) RUNS=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+shift $((OPTIND - 1))
+[ $# -le 1 ] || usage
+
+now_us() {
+	local t
+	t=$(date +%s%N)
+	echo $((t / 1000))
+}
+
+# Send a qtest command, leave its reply's value, if any, in $REPLY
+qtest() {
+	local line
+	echo "$*" >&"${QTEST[1]}" || return 1
+	while read -r -u "${QTEST[0]}" line; do
+		case $line in
+		OK*)
+			REPLY=${line#OK}
+			REPLY=${REPLY# }
+			return 0
+			;;
+		IRQ*)
+			;;
+		*)
+			return 1
+			;;
+		esac
+	done
+	return 1
+}
+
+bswap32() {
+	local v=$1
+	printf '0x%08x' $(( (v & 0xff) << 24 | (v & 0xff00) << 8 |
+			    (v >> 8) & 0xff00 | (v >> 24) & 0xff ))
+}
+
+# DMA @2 bytes of fw_cfg item @1 to DMA_BUF, the firmware's way
+fw_cfg_dma_read() {
+	local ctl=$(( ($1 << 16) | FW_CFG_DMA_CTL_SELECT | FW_CFG_DMA_CTL_READ ))
+
+	qtest "write $DMA_DESC 16 0x$(printf '%08x%08x%016x' \
+		$ctl "$2" $DMA_BUF)" &&
+	qtest "outl $FW_CFG_DMA_ADDR_HIGH 0" &&
+	qtest "outl $FW_CFG_DMA_ADDR_LOW $(bswap32 $DMA_DESC)" &&
+	qtest "read $DMA_DESC 4" || return 1
+	# the device clears the control field once done, leaves ERROR if failed
+	[ $((REPLY)) -eq 0 ]
+}
+
+# Set FILE_SELECT and FILE_SIZE to fw_cfg file @1, from the directory in $DIR
+fw_cfg_find() {
+	local name entry i
+	name=$(printf '%s' "$1" | od -An -tx1 -v | tr -d ' \n')
+	for ((i = 0; i < ${#DIR}; i += 128)); do
+		entry=${DIR:i:128}
+		if [ "${entry:16:${#name}+2}" = "${name}00" ]; then
+			FILE_SIZE=$((16#${entry:0:8}))
+			FILE_SELECT=$((16#${entry:8:4}))
+			return 0
+		fi
+	done
+	return 1
+}
+
+# Read the fw_cfg file directory into $DIR, one 128 hex digit entry each
+fw_cfg_read_dir() {
+	local count
+	fw_cfg_dma_read $FW_CFG_FILE_DIR 4 &&
+	qtest "read $DMA_BUF 4" || return 1
+	count=$((REPLY))
+	fw_cfg_dma_read $FW_CFG_FILE_DIR $((4 + count * 64)) &&
+	qtest "read $(printf '0x%x' $((DMA_BUF + 4))) $((count * 64))" || return 1
+	DIR=${REPLY#0x}
+}
+
+qtest_stop() {
+	{ kill "$QTEST_PID"; wait "$QTEST_PID"; } 2>/dev/null
+}
+
+# QEMU's stderr, of the last start
+QTEST_LOG=$(mktemp) || exit 2
+trap 'rm -f "$QTEST_LOG"' EXIT
+
+# Start QEMU for machine @1 with @2 CPUs and @3 of memory, plus the
+# further arguments @4..., as coprocess QTEST
+qtest_start() {
+	local machine=$1 smp=$2 mem=$3
+	shift 3
+
+	coproc QTEST {
+		exec "$QEMU" -machine "$machine,memory-backend=mem" -accel qtest \
+			-object "memory-backend-ram,id=mem,size=$mem,reserve=off" \
+			-cpu qemu64,phys-bits=46 -smp "$smp" -nodefaults \
+			-display none -qtest stdio "$@" 2>"$QTEST_LOG"
+	}
+}
+
+# One run of configuration @1..., prints "MICROSECONDS RSS-KIB"
+bench_run() {
+	local machine=$1 smp=$2 mem=$3 start rss file
+	local args=()
+	shift 3
+	for opt in "$@"; do
+		args+=(-smbios "$opt")
+	done
+
+	start=$(now_us)
+	qtest_start "$machine" "$smp" "$mem" "${args[@]}"
+
+	if ! fw_cfg_read_dir; then
+		qtest_stop
+		return 1
+	fi
+	for file in etc/smbios/smbios-anchor etc/smbios/smbios-tables; do
+		if ! fw_cfg_find $file ||
+		   ! fw_cfg_dma_read $FILE_SELECT $FILE_SIZE; then
+			qtest_stop
+			return 1
+		fi
+	done
+	echo -n "$(( $(now_us) - start )) "
+	rss=$(awk '/^VmRSS:/ { print $2 }' "/proc/$QTEST_PID/status")
+	echo "$rss"
+	qtest_stop
+	return 0
+}
+
+# Bus number byte of the type 41 structure in the tables @1, as hex
+# digits, or "-" if the structures don't lead up to the type 127 end
+type41_bus() {
+	local hex=$1 off=0 end type bus=-
+
+	while ((off * 2 + 4 <= ${#hex})); do
+		type=$((16#${hex:off*2:2}))
+		end=$((off + 16#${hex:off*2+2:2}))
+		if [ "$type" -eq 41 ]; then
+			bus=$((16#${hex:(off+9)*2:2}))
+		fi
+		while [ "${hex:end*2:4}" != 0000 ]; do
+			end=$((end + 1))
+			((end * 2 + 4 <= ${#hex})) || break 2
+		done
+		off=$((end + 2))
+		if [ "$type" -eq 127 ]; then
+			if ((off * 2 == ${#hex})); then
+				echo "$bus"
+				return
+			fi
+			break
+		fi
+	done
+	echo -
+}
+
+# Bus numbers of devices behind bridges are only known once the
+# firmware numbered the bridges, smbios.c patches them in whenever the
+# tables are selected. Number a root port's secondary bus 1 like the
+# firmware would, then check the type 41 entry of the device behind it.
+# AUTO picks 2.1 here, so the type 4 tables in front of the entry
+# shrink after it was built. Prints PASS or FAIL.
+bus_check() {
+	local tables
+
+	qtest_start q35,smbios-entry-point-type=auto 32,sockets=4 2G \
+		-device pcie-root-port,id=rp0,bus=pcie.0,chassis=1,addr=0x10 \
+		-device virtio-rng-pci,id=rng0,bus=rp0 \
+		-smbios type=41,designation=check,pcidev=rng0,kind=other
+
+	# 00:10.0 config dword 0x18: primary 0, secondary 1, subordinate 1
+	if ! qtest "outl 0xcf8 0x80008018" ||
+	   ! qtest "outl 0xcfc 0x00010100" ||
+	   ! fw_cfg_read_dir ||
+	   ! fw_cfg_find etc/smbios/smbios-tables ||
+	   ! fw_cfg_dma_read $FILE_SELECT $FILE_SIZE ||
+	   ! qtest "read $DMA_BUF $FILE_SIZE"; then
+		qtest_stop
+		echo ERROR
+		return
+	fi
+	tables=${REPLY#0x}
+	qtest_stop
+
+	if [ "$(type41_bus "$tables")" = 1 ]; then
+		echo PASS
+	else
+		echo FAIL
+	fi
+}
+
+# Median of the numbers in @@
+median() {
+	printf '%s\n' "$@" | sort -n |
+		awk '{ v[NR] = $1 } END { print v[int((NR + 1) / 2)] }'
+}
+
+# Microseconds @1 as milliseconds
+ms() {
+	printf '%d.%03d' $(($1 / 1000)) $(($1 % 1000))
+}
+
+if [ $# -eq 1 ]; then
+	MATRIX=$(cat "$1") || exit 2
+else
+	MATRIX=$DEFAULT_MATRIX
+fi
+
+failed=0
+printf '%-16s %10s %10s %10s %10s  %s\n' \
+	config median-ms max-ms rss-kib budget-ms result
+while read -r name budget machine smp mem opts; do
+	case $name in
+	''|'#'*) continue ;;
+	esac
+
+	times=()
+	rsss=()
+	for ((run = 0; run < RUNS; run++)); do
+		# shellcheck disable=SC2086 # one -smbios per word
+		if ! out=$(bench_run "$machine" "$smp" "$mem" $opts); then
+			times=()
+			break
+		fi
+		times+=("${out% *}")
+		rsss+=("${out#* }")
+	done
+
+	if [ ${#times[@]} -eq 0 ]; then
+		printf '%-16s %10s %10s %10s %10s  %s\n' \
+			"$name" - - - "$budget" ERROR
+		head -n 1 "$QTEST_LOG" | sed 's/^/    /'
+		failed=1
+		continue
+	fi
+
+	med=$(median "${times[@]}")
+	max=$(printf '%s\n' "${times[@]}" | sort -n | tail -n 1)
+	rss=$(median "${rsss[@]}")
+	result=PASS
+	if [ $((med / 1000)) -gt "$budget" ]; then
+		result=FAIL
+		failed=1
+	fi
+	printf '%-16s %10s %10s %10s %10s  %s\n' \
+		"$name" "$(ms "$med")" "$(ms "$max")" "$rss" "$budget" $result
+done <<< "$MATRIX"
+
+result=$(bus_check)
+[ "$result" = PASS ] || failed=1
+printf '%-16s %10s %10s %10s %10s  %s\n' q35-bridge-bus - - - - "$result"
+[ "$result" != ERROR ] || head -n 1 "$QTEST_LOG" | sed 's/^/    /'
+
+exit $failed
@@ -0,0 +1,309 @@
+/*
+ * SMBIOS table build benchmark
+ *
+ * Builds the SMBIOS tables of synthetic machines with the same code QEMU
+ * runs at machine init and reports what each build cost: wall time,
+ * (re)allocations of the table blob, the largest blob allocated and the
+ * size of the tables. Every dimension (sockets, cores, RAM, type 9 and
+ * type 41 entries, OEM strings) is swept on its own from a small base
+ * machine, so a regression shows against the input that causes it.
+ *
+ * Lives in the QEMU tree as contrib/smbios/smbios-build-bench.c, linked
+ * against hw/smbios/smbios.c and contrib/smbios/smbios-tools-stubs.c.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version. See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <getopt.h>
+#include "qemu/units.h"
+#include "qemu/cutils.h"
+#include "qemu/config-file.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "hw/boards.h"
+#include "hw/firmware/smbios.h"
+
+typedef enum BenchKind {
+    BENCH_SOCKETS,
+    BENCH_CORES,
+    BENCH_MEMORY,
+    BENCH_TYPE9,
+    BENCH_TYPE41,
+    BENCH_OEM_STRINGS,
+} BenchKind;
+
+typedef struct BenchDimension {
+    const char *name;
+    BenchKind kind;
+    unsigned cnt;
+    uint64_t values[8];
+} BenchDimension;
+
+/* the base machine is 1 socket, 4 cores, 2 threads and 8 GiB */
+static const BenchDimension bench_dimensions[] = {
+    { "sockets", BENCH_SOCKETS, 7, { 1, 2, 4, 8, 16, 64, 255 } },
+    { "cores", BENCH_CORES, 6, { 1, 4, 16, 64, 128, 256 } },
+    { "memory", BENCH_MEMORY, 6,
+      { 1 * GiB, 8 * GiB, 64 * GiB, 512 * GiB, 4 * TiB, 16 * TiB } },
+    { "type9", BENCH_TYPE9, 5, { 0, 8, 32, 128, 512 } },
+    { "type41", BENCH_TYPE41, 5, { 0, 8, 32, 128, 255 } },
+    { "oem-strings", BENCH_OEM_STRINGS, 5, { 0, 8, 64, 256, 1024 } },
+};
+
+typedef struct BenchConfig {
+    MachineState ms;
+    struct smbios_phys_mem_area mem[2];
+    unsigned mem_cnt;
+    GPtrArray *opts;            /* QemuOpts of the -smbios options */
+} BenchConfig;
+
+static void G_GNUC_PRINTF(2, 3)
+bench_config_add_opts(BenchConfig *cfg, const char *fmt, ...)
+{
+    g_autofree char *str = NULL;
+    va_list ap;
+
+    va_start(ap, fmt);
+    str = g_strdup_vprintf(fmt, ap);
+    va_end(ap);
+    g_ptr_array_add(cfg->opts, qemu_opts_parse(qemu_find_opts("smbios"),
+                                               str, false, &error_fatal));
+}
+
+static void bench_config_init(BenchConfig *cfg, const BenchDimension *dim,
+                              uint64_t value)
+{
+    MachineState *ms = &cfg->ms;
+    uint64_t sockets = 1, cores = 4, threads = 2, below_4g;
+    g_autoptr(GString) oem = NULL;
+    uint64_t i;
+
+    memset(cfg, 0, sizeof(*cfg));
+    ms->ram_size = 8 * GiB;
+    cfg->opts = g_ptr_array_new();
+
+    switch (dim->kind) {
+    case BENCH_SOCKETS:
+        sockets = value;
+        break;
+    case BENCH_CORES:
+        cores = value;
+        break;
+    case BENCH_MEMORY:
+        ms->ram_size = value;
+        break;
+    case BENCH_TYPE9:
+        for (i = 0; i < value; i++) {
+            bench_config_add_opts(cfg, "type=9,slot_designation=PCIE%"
+                                  PRIu64 ",slot_type=0xa5,slot_id=%" PRIu64,
+                                  i, i);
+        }
+        break;
+    case BENCH_TYPE41:
+        for (i = 0; i < value; i++) {
+            bench_config_add_opts(cfg, "type=41,designation=Onboard LAN %"
+                                  PRIu64 ",kind=ethernet,instance=%" PRIu64,
+                                  i, i + 1);
+        }
+        break;
+    case BENCH_OEM_STRINGS:
+        if (!value) {
+            break;
+        }
+        oem = g_string_new("type=11");
+        for (i = 0; i < value; i++) {
+            g_string_append_printf(oem, ",value=OEM string %04" PRIu64
+                                   " of a benchmark machine", i);
+        }
+        bench_config_add_opts(cfg, "%s", oem->str);
+        break;
+    }
+
+    ms->smp.sockets = sockets;
+    ms->smp.dies = 1;
+    ms->smp.clusters = 1;
+    ms->smp.cores = cores;
+    ms->smp.threads = threads;
+    ms->smp.cpus = ms->smp.max_cpus = sockets * cores * threads;
+
+    /* pc_q35_init(): keep 2 GiB below 4 GiB if it doesn't all fit */
+    below_4g = MIN(ms->ram_size >= 0xb0000000 ? 0x80000000 : 0xb0000000,
+                   ms->ram_size);
+    cfg->mem[cfg->mem_cnt++] = (struct smbios_phys_mem_area) { 0, below_4g };
+    if (ms->ram_size > below_4g) {
+        cfg->mem[cfg->mem_cnt++] = (struct smbios_phys_mem_area) {
+            4 * GiB, ms->ram_size - below_4g,
+        };
+    }
+}
+
+static void bench_config_free(BenchConfig *cfg)
+{
+    guint i;
+
+    for (i = 0; i < cfg->opts->len; i++) {
+        qemu_opts_del(g_ptr_array_index(cfg->opts, i));
+    }
+    g_ptr_array_unref(cfg->opts);
+}
+
+/* Build the tables of @cfg once, with a builder of its own */
+static void bench_config_build(BenchConfig *cfg, SmbiosEntryPointType ep_type,
+                               SmbiosBuildStats *stats)
+{
+    SmbiosBuilder *b = smbios_builder_new();
+    uint8_t *tables, *anchor;
+    size_t tables_len, anchor_len;
+    guint i;
+
+    smbios_builder_set_defaults(b, "ASUS", "ASUS-PC", "pc-q35-9.0", true);
+    smbios_builder_set_cpuid(b, 0x000906a3, 0xbfebfbff);
+    for (i = 0; i < cfg->opts->len; i++) {
+        smbios_builder_entry_add(b, g_ptr_array_index(cfg->opts, i),
+                                 &error_fatal);
+    }
+    smbios_builder_get_tables(b, &cfg->ms, ep_type, cfg->mem, cfg->mem_cnt,
+                              &tables, &tables_len, &anchor, &anchor_len,
+                              &error_fatal);
+    smbios_builder_get_build_stats(b, stats);
+    smbios_builder_free(b);
+}
+
+static int bench_cmp_us(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void bench_dimension_run(const BenchDimension *dim,
+                                SmbiosEntryPointType ep_type, unsigned runs)
+{
+    g_autofree int64_t *us = g_new(int64_t, runs);
+    unsigned v, r;
+
+    for (v = 0; v < dim->cnt; v++) {
+        g_autofree char *value = NULL;
+        SmbiosBuildStats stats;
+        BenchConfig cfg;
+
+        bench_config_init(&cfg, dim, dim->values[v]);
+        for (r = 0; r < runs; r++) {
+            bench_config_build(&cfg, ep_type, &stats);
+            us[r] = stats.build_us;
+        }
+        bench_config_free(&cfg);
+        qsort(us, runs, sizeof(*us), bench_cmp_us);
+
+        if (dim->kind == BENCH_MEMORY) {
+            value = size_to_str(dim->values[v]);
+        } else {
+            value = g_strdup_printf("%" PRIu64, dim->values[v]);
+        }
+        /* every run builds the same tables, only the time varies */
+        printf("%-12s %10s %10" PRId64 " %10" PRId64 " %7u %10zu %10zu"
+               " %6u %3s\n", dim->name, value, us[runs / 2], us[runs - 1],
+               stats.allocs, stats.peak_size, stats.tables_len,
+               stats.structures,
+               stats.ep_type == SMBIOS_ENTRY_POINT_TYPE_64 ? "3.0" : "2.1");
+    }
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-r RUNS] [-e 32|64|auto] [DIMENSION...]\n"
+           "Time SMBIOS table builds while sweeping one DIMENSION at a\n"
+           "time (default: all of sockets, cores, memory, type9, type41\n"
+           "and oem-strings).\n"
+           "\n"
+           "  -r, --runs=RUNS          builds per configuration (default: 20)\n"
+           "  -e, --entry-point=TYPE   entry point to build for (default: "
+           "auto)\n"
+           "  -h, --help               display this help and exit\n"
+           "\n"
+           "Prints, per configuration, the median and worst build time in\n"
+           "microseconds, the allocations of the table blob, the largest\n"
+           "blob allocated, the size of the tables, the number of\n"
+           "structures and the entry point built.\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "runs", required_argument, NULL, 'r' },
+        { "entry-point", required_argument, NULL, 'e' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    SmbiosEntryPointType ep_type = SMBIOS_ENTRY_POINT_TYPE_AUTO;
+    unsigned long runs = 20;
+    unsigned d;
+    int c, i;
+
+    error_init(argv[0]);
+    qemu_init_exec_dir(argv[0]);
+    module_call_init(MODULE_INIT_OPTS);
+
+    while ((c = getopt_long(argc, argv, "r:e:h", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'r':
+            if (qemu_strtoul(optarg, NULL, 0, &runs) < 0 || !runs) {
+                error_report("Invalid number of runs '%s'", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'e':
+            if (g_str_equal(optarg, "auto")) {
+                ep_type = SMBIOS_ENTRY_POINT_TYPE_AUTO;
+            } else if (g_str_equal(optarg, "32")) {
+                ep_type = SMBIOS_ENTRY_POINT_TYPE_32;
+            } else if (g_str_equal(optarg, "64")) {
+                ep_type = SMBIOS_ENTRY_POINT_TYPE_64;
+            } else {
+                error_report("Entry point must be 32, 64 or auto");
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (i = optind; i < argc; i++) {
+        for (d = 0; d < ARRAY_SIZE(bench_dimensions); d++) {
+            if (g_str_equal(argv[i], bench_dimensions[d].name)) {
+                break;
+            }
+        }
+        if (d == ARRAY_SIZE(bench_dimensions)) {
+            error_report("Unknown dimension '%s'", argv[i]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf("%-12s %10s %10s %10s %7s %10s %10s %6s %3s\n", "dimension",
+           "value", "median-us", "max-us", "allocs", "peak-bytes",
+           "tables", "count", "ep");
+    for (d = 0; d < ARRAY_SIZE(bench_dimensions); d++) {
+        const BenchDimension *dim = &bench_dimensions[d];
+
+        for (i = optind; i < argc; i++) {
+            if (g_str_equal(argv[i], dim->name)) {
+                break;
+            }
+        }
+        if (optind == argc || i < argc) {
+            bench_dimension_run(dim, ep_type, runs);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,360 @@
+/*
+ * SMBIOS fleet compiler
+ *
+ * Builds the SMBIOS tables of many VMs at once, in parallel, with the
+ * same code QEMU runs at machine init, and writes them out as blobs for
+ * '-smbios file='. Provisioning a fleet then generates each profile's
+ * tables once instead of at every VM's boot.
+ *
+ * Lives in the QEMU tree as contrib/smbios/smbios-fleet.c, linked
+ * against hw/smbios/smbios.c and contrib/smbios/smbios-tools-stubs.c.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version. See the COPYING file in the
+ * top-level directory.
+ */
+
+/*
+ * A profile file holds one group per VM:
+ *
+ *   [vm-100]
+ *   sockets=2
+ *   cores=8
+ *   threads=2
+ *   memory=16G
+ *   entry-point=auto
+ *   smbios=type=1,serial=S100;type=17,dimm-size=8G
+ *
+ * memory is split below and above 4 GiB the way q35 does it, unless
+ * below-4g-mem says otherwise. entry-point (32, 64 or auto) must match
+ * the VM's smbios-entry-point-type. cpuid-version and cpuid-features
+ * are the CPUID leaf 1 EAX and EDX values of the VM's CPU model.
+ *
+ * Each VM gets OUTDIR/NAME/, one file per structure, and OUTDIR/NAME.args
+ * with the matching '-smbios file=' options. Types 9 and 41 entries that
+ * name a PCI device, and type 38 (IPMI), depend on the running machine's
+ * devices: keep those on the VM's own command line.
+ */
+
+#include "qemu/osdep.h"
+#include <getopt.h>
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
+#include "qemu/config-file.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/error-report.h"
+#include "qapi/error.h"
+#include "hw/boards.h"
+#include "hw/firmware/smbios.h"
+
+typedef struct FleetVM {
+    char *name;
+    MachineState ms;
+    SmbiosEntryPointType ep_type;
+    struct smbios_phys_mem_area mem[2];
+    unsigned mem_cnt;
+    uint32_t cpuid_version, cpuid_features;
+    GPtrArray *opts;            /* QemuOpts, parsed by the main thread */
+    const char *outdir;
+    Error *err;
+    unsigned structures;
+} FleetVM;
+
+static bool fleet_get_uint(GKeyFile *kf, const char *group, const char *key,
+                           uint64_t def, uint64_t *val, Error **errp)
+{
+    g_autofree char *str = g_key_file_get_string(kf, group, key, NULL);
+
+    if (!str) {
+        *val = def;
+        return true;
+    }
+    if (qemu_strtou64(str, NULL, 0, val) < 0) {
+        error_setg(errp, "[%s] %s: invalid number '%s'", group, key, str);
+        return false;
+    }
+    return true;
+}
+
+static bool fleet_get_size(GKeyFile *kf, const char *group, const char *key,
+                           uint64_t def, uint64_t *val, Error **errp)
+{
+    g_autofree char *str = g_key_file_get_string(kf, group, key, NULL);
+
+    if (!str) {
+        *val = def;
+        return true;
+    }
+    if (qemu_strtosz_MiB(str, NULL, val) < 0) {
+        error_setg(errp, "[%s] %s: invalid size '%s'", group, key, str);
+        return false;
+    }
+    return true;
+}
+
+static bool fleet_vm_parse(FleetVM *vm, GKeyFile *kf, const char *group,
+                           Error **errp)
+{
+    MachineState *ms = &vm->ms;
+    g_autofree char *ep = NULL;
+    g_auto(GStrv) smbios = NULL;
+    uint64_t sockets, cores, threads, below_4g, val;
+    gsize i, n;
+
+    if (!fleet_get_uint(kf, group, "sockets", 1, &sockets, errp) ||
+        !fleet_get_uint(kf, group, "cores", 1, &cores, errp) ||
+        !fleet_get_uint(kf, group, "threads", 1, &threads, errp) ||
+        !fleet_get_size(kf, group, "memory", 128 * MiB, &ms->ram_size,
+                        errp)) {
+        return false;
+    }
+    if (!sockets || !cores || !threads ||
+        sockets * cores * threads > UINT32_MAX) {
+        error_setg(errp, "[%s] invalid CPU topology", group);
+        return false;
+    }
+    ms->smp.sockets = sockets;
+    ms->smp.dies = 1;
+    ms->smp.clusters = 1;
+    ms->smp.cores = cores;
+    ms->smp.threads = threads;
+    ms->smp.cpus = ms->smp.max_cpus = sockets * cores * threads;
+
+    /* pc_q35_init(): keep 2 GiB below 4 GiB if it doesn't all fit */
+    if (!fleet_get_size(kf, group, "below-4g-mem",
+                        ms->ram_size >= 0xb0000000 ? 0x80000000 : 0xb0000000,
+                        &below_4g, errp)) {
+        return false;
+    }
+    below_4g = MIN(below_4g, ms->ram_size);
+    vm->mem[vm->mem_cnt++] = (struct smbios_phys_mem_area) { 0, below_4g };
+    if (ms->ram_size > below_4g) {
+        vm->mem[vm->mem_cnt++] = (struct smbios_phys_mem_area) {
+            4 * GiB, ms->ram_size - below_4g,
+        };
+    }
+
+    ep = g_key_file_get_string(kf, group, "entry-point", NULL);
+    if (!ep || g_str_equal(ep, "auto")) {
+        vm->ep_type = SMBIOS_ENTRY_POINT_TYPE_AUTO;
+    } else if (g_str_equal(ep, "32")) {
+        vm->ep_type = SMBIOS_ENTRY_POINT_TYPE_32;
+    } else if (g_str_equal(ep, "64")) {
+        vm->ep_type = SMBIOS_ENTRY_POINT_TYPE_64;
+    } else {
+        error_setg(errp, "[%s] entry-point must be 32, 64 or auto", group);
+        return false;
+    }
+
+    if (!fleet_get_uint(kf, group, "cpuid-version", 0x000906a3, &val, errp)) {
+        return false;
+    }
+    vm->cpuid_version = val;
+    if (!fleet_get_uint(kf, group, "cpuid-features", 0xbfebfbff, &val,
+                        errp)) {
+        return false;
+    }
+    vm->cpuid_features = val;
+
+    /* QemuOpts lists aren't thread safe, parse them all up front */
+    vm->opts = g_ptr_array_new();
+    smbios = g_key_file_get_string_list(kf, group, "smbios", &n, NULL);
+    for (i = 0; smbios && i < n; i++) {
+        QemuOpts *opts = qemu_opts_parse(qemu_find_opts("smbios"),
+                                         smbios[i], false, errp);
+
+        if (!opts) {
+            error_prepend(errp, "[%s] smbios: ", group);
+            return false;
+        }
+        g_ptr_array_add(vm->opts, opts);
+    }
+
+    vm->name = g_strdup(group);
+    return true;
+}
+
+static bool fleet_vm_write(FleetVM *vm, const uint8_t *tables, size_t len,
+                           Error **errp)
+{
+    g_autofree char *dir = g_build_filename(vm->outdir, vm->name, NULL);
+    g_autofree char *args_name = g_strconcat(vm->name, ".args", NULL);
+    g_autofree char *args_path = g_build_filename(vm->outdir, args_name,
+                                                  NULL);
+    g_autoptr(GString) args = g_string_new(NULL);
+    g_autoptr(GError) err = NULL;
+    size_t off = 0, size;
+
+    if (g_mkdir_with_parents(dir, 0755) < 0) {
+        error_setg_errno(errp, errno, "Cannot create %s", dir);
+        return false;
+    }
+
+    for (; off < len; off += size) {
+        const struct smbios_structure_header *header =
+            (const struct smbios_structure_header *)(tables + off);
+        g_autofree char *file = NULL;
+        g_autofree char *path = NULL;
+
+        size = smbios_structure_size(tables + off, len - off);
+        if (header->type == 127) {
+            continue; /* QEMU always ends the tables itself */
+        }
+        file = g_strdup_printf("%04x-type%u.bin",
+                               le16_to_cpu(header->handle), header->type);
+        path = g_build_filename(dir, file, NULL);
+        if (!g_file_set_contents(path, (const char *)tables + off, size,
+                                 &err)) {
+            error_setg(errp, "Cannot write %s: %s", path, err->message);
+            return false;
+        }
+        g_string_append_printf(args, "-smbios file=%s\n", path);
+        vm->structures++;
+    }
+
+    if (!g_file_set_contents(args_path, args->str, args->len, &err)) {
+        error_setg(errp, "Cannot write %s: %s", args_path, err->message);
+        return false;
+    }
+    return true;
+}
+
+/* Runs in the thread pool, one VM at a time per thread */
+static void fleet_vm_build(gpointer data, gpointer user_data)
+{
+    FleetVM *vm = data;
+    SmbiosBuilder *b = smbios_builder_new();
+    uint8_t *tables, *anchor;
+    size_t tables_len, anchor_len;
+    guint i;
+
+    smbios_builder_set_defaults(b, "ASUS", "ASUS-PC", "pc-q35-9.0", true);
+    smbios_builder_set_cpuid(b, vm->cpuid_version, vm->cpuid_features);
+    for (i = 0; i < vm->opts->len; i++) {
+        smbios_builder_entry_add(b, g_ptr_array_index(vm->opts, i),
+                                 &vm->err);
+        if (vm->err) {
+            goto out;
+        }
+    }
+
+    if (smbios_builder_get_tables(b, &vm->ms, vm->ep_type, vm->mem,
+                                  vm->mem_cnt, &tables, &tables_len,
+                                  &anchor, &anchor_len, &vm->err)) {
+        fleet_vm_write(vm, tables, tables_len, &vm->err);
+    }
+out:
+    if (vm->err) {
+        error_prepend(&vm->err, "%s: ", vm->name);
+    }
+    smbios_builder_free(b);
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-j JOBS] -o OUTDIR PROFILE...\n"
+           "Build the SMBIOS tables of every VM in the PROFILEs for use\n"
+           "with '-smbios file='.\n"
+           "\n"
+           "  -j, --jobs=JOBS      build JOBS VMs at once (default: one\n"
+           "                       per host CPU)\n"
+           "  -o, --output=OUTDIR  write the tables below OUTDIR\n"
+           "  -h, --help           display this help and exit\n",
+           name);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option long_opts[] = {
+        { "jobs", required_argument, NULL, 'j' },
+        { "output", required_argument, NULL, 'o' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 },
+    };
+    g_autoptr(GPtrArray) vms = g_ptr_array_new();
+    const char *outdir = NULL;
+    unsigned long jobs = g_get_num_processors();
+    g_autoptr(GError) gerr = NULL;
+    GThreadPool *pool;
+    int ret = EXIT_SUCCESS;
+    int c, i;
+    guint v;
+
+    error_init(argv[0]);
+    qemu_init_exec_dir(argv[0]);
+    module_call_init(MODULE_INIT_OPTS);
+
+    while ((c = getopt_long(argc, argv, "j:o:h", long_opts, NULL)) != -1) {
+        switch (c) {
+        case 'j':
+            if (qemu_strtoul(optarg, NULL, 0, &jobs) < 0 || !jobs) {
+                error_report("Invalid number of jobs '%s'", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'o':
+            outdir = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (!outdir || optind == argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    for (i = optind; i < argc; i++) {
+        g_autoptr(GKeyFile) kf = g_key_file_new();
+        g_auto(GStrv) groups = NULL;
+        gsize n, g;
+
+        if (!g_key_file_load_from_file(kf, argv[i], G_KEY_FILE_NONE,
+                                       &gerr)) {
+            error_report("Cannot load %s: %s", argv[i], gerr->message);
+            return EXIT_FAILURE;
+        }
+        groups = g_key_file_get_groups(kf, &n);
+        for (g = 0; g < n; g++) {
+            FleetVM *vm = g_new0(FleetVM, 1);
+            Error *err = NULL;
+
+            vm->outdir = outdir;
+            if (!fleet_vm_parse(vm, kf, groups[g], &err)) {
+                error_prepend(&err, "%s: ", argv[i]);
+                error_report_err(err);
+                return EXIT_FAILURE;
+            }
+            g_ptr_array_add(vms, vm);
+        }
+    }
+
+    pool = g_thread_pool_new(fleet_vm_build, NULL,
+                             MIN(jobs, MAX(vms->len, 1)), false, &gerr);
+    if (!pool) {
+        error_report("Cannot start worker threads: %s", gerr->message);
+        return EXIT_FAILURE;
+    }
+    for (v = 0; v < vms->len; v++) {
+        g_thread_pool_push(pool, g_ptr_array_index(vms, v), NULL);
+    }
+    g_thread_pool_free(pool, false, true);
+
+    for (v = 0; v < vms->len; v++) {
+        FleetVM *vm = g_ptr_array_index(vms, v);
+
+        if (vm->err) {
+            error_report_err(vm->err);
+            ret = EXIT_FAILURE;
+        } else {
+            printf("%s: %u structures\n", vm->name, vm->structures);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,126 @@
+/*
+ * What hw/smbios/smbios.c needs from the system emulator, for the tools
+ *
+ * The SMBIOS tools only use SmbiosBuilder, which never looks at a running
+ * machine: no fw_cfg, PCI devices, IPMI or migration. These stand in for
+ * the parts of the system emulator smbios.c links against, so that it
+ * builds next to libqemuutil and libqom alone.
+ *
+ * Lives in the QEMU tree as contrib/smbios/smbios-tools-stubs.c.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version. See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/uuid.h"
+#include "hw/boards.h"
+#include "hw/nvram/fw_cfg.h"
+#include "hw/pci/pci.h"
+#include "hw/firmware/smbios.h"
+#include "migration/vmstate.h"
+#include "sysemu/runstate.h"
+#include "sysemu/reset.h"
+#include "sysemu/sysemu.h"
+
+MachineState *current_machine;
+QemuUUID qemu_uuid;
+bool qemu_uuid_set;
+
+const VMStateInfo vmstate_info_uint32 = { .name = "uint32" };
+const VMStateInfo vmstate_info_buffer = { .name = "buffer" };
+
+/* hw/core/machine-smp.c */
+unsigned int machine_topo_get_cores_per_socket(const MachineState *ms)
+{
+    return ms->smp.cores * ms->smp.clusters * ms->smp.dies;
+}
+
+unsigned int machine_topo_get_threads_per_socket(const MachineState *ms)
+{
+    return ms->smp.threads * machine_topo_get_cores_per_socket(ms);
+}
+
+Object *qdev_get_machine(void)
+{
+    g_assert_not_reached();
+}
+
+BusState *qdev_get_parent_bus(const DeviceState *dev)
+{
+    g_assert_not_reached();
+}
+
+int pci_dev_bus_num(const PCIDevice *dev)
+{
+    g_assert_not_reached();
+}
+
+bool pci_bus_is_root(PCIBus *bus)
+{
+    g_assert_not_reached();
+}
+
+FWCfgState *fw_cfg_find(void)
+{
+    return NULL;
+}
+
+void *fw_cfg_modify_file(FWCfgState *s, const char *filename, void *data,
+                         size_t len)
+{
+    g_assert_not_reached();
+}
+
+void smbios_build_type_38_table(void)
+{
+}
+
+void smbios_add_usr_blob_size(size_t size)
+{
+}
+
+int vmstate_register_with_alias_id(VMStateIf *obj, uint32_t instance_id,
+                                   const VMStateDescription *vmsd,
+                                   void *base, int alias_id,
+                                   int required_for_version, Error **errp)
+{
+    return 0;
+}
+
+void vmstate_unregister(VMStateIf *obj, const VMStateDescription *vmsd,
+                        void *opaque)
+{
+}
+
+VMChangeStateEntry *qemu_add_vm_change_state_handler(VMChangeStateHandler *cb,
+                                                     void *opaque)
+{
+    return NULL;
+}
+
+void qemu_del_vm_change_state_handler(VMChangeStateEntry *e)
+{
+}
+
+bool runstate_check(RunState state)
+{
+    return state == RUN_STATE_PRELAUNCH;
+}
+
+void qemu_register_reset(QEMUResetHandler *func, void *opaque)
+{
+}
+
+void qemu_unregister_reset(QEMUResetHandler *func, void *opaque)
+{
+}
+
+void qemu_add_exit_notifier(Notifier *notify)
+{
+}
+
+void qemu_remove_exit_notifier(Notifier *notify)
+{
+}
@@ -17,52 +17,34 @@
 
 #include "qemu/osdep.h"
 #include "qemu/units.h"
+#include "qemu/cutils.h"
 #include "qapi/error.h"
 #include "qemu/config-file.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/error-report.h"
+#include "qemu/timer.h"
+#include "qom/object.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/runstate.h"
+#include "sysemu/reset.h"
+#include "migration/vmstate.h"
+#include "qapi/qapi-commands-machine.h"
 #include "qemu/uuid.h"
 #include "hw/firmware/smbios.h"
-#include "hw/loader.h"
 #include "hw/boards.h"
 #include "hw/pci/pci_bus.h"
 #include "hw/pci/pci_device.h"
+#include "hw/mem/pc-dimm.h"
+#include "hw/mem/nvdimm.h"
+#include "hw/ipmi/ipmi.h"
+#include "hw/nvram/fw_cfg.h"
 #include "smbios_build.h"
-
-static bool smbios_uuid_encoded = true;
-/*
- * SMBIOS tables provided by user with '-smbios file=<foo>' option
- */
-uint8_t *usr_blobs;
-size_t usr_blobs_len;
-static unsigned usr_table_max;
-static unsigned usr_table_cnt;
-
-uint8_t *smbios_tables;
-size_t smbios_tables_len;
-unsigned smbios_table_max;
-unsigned smbios_table_cnt;
-
-static SmbiosEntryPoint ep;
-
-static int smbios_type4_count = 0;
-static bool smbios_have_defaults;
-static uint32_t smbios_cpuid_version, smbios_cpuid_features;
-
-DECLARE_BITMAP(smbios_have_binfile_bitmap, SMBIOS_MAX_TYPE + 1);
-DECLARE_BITMAP(smbios_have_fields_bitmap, SMBIOS_MAX_TYPE + 1);
-
-smbios_type0_t smbios_type0;
-smbios_type1_t smbios_type1;
-
-static struct {
-    const char *manufacturer, *product, *version, *serial, *asset, *location;
-} type2;
-
-static struct {
-    const char *manufacturer, *version, *serial, *asset, *sku;
-} type3;
+#include "trace.h"
+#ifdef CONFIG_LINUX
+#include <sys/file.h>
+#include <sys/mman.h>
+#endif
 
 /*
  * SVVP requires max_speed and current_speed to be set and not being
@@ -71,25 +53,11 @@ static struct {
  */
 #define DEFAULT_CPU_SPEED 2000
 
-static struct {
-    uint16_t processor_family;
-    const char *sock_pfx, *manufacturer, *version, *serial, *asset, *part;
-    uint64_t max_speed;
-    uint64_t current_speed;
-    uint64_t processor_id;
-} type4 = {
-    .max_speed = DEFAULT_CPU_SPEED,
-    .current_speed = DEFAULT_CPU_SPEED,
-    .processor_id = 0,
-    .processor_family = 0x01, /* Other */
-};
-
 struct type8_instance {
     const char *internal_reference, *external_reference;
     uint8_t connector_type, port_type;
     QTAILQ_ENTRY(type8_instance) next;
 };
-static QTAILQ_HEAD(, type8_instance) type8 = QTAILQ_HEAD_INITIALIZER(type8);
 
 /* type 9 instance for parsing */
 struct type9_instance {
@@ -99,17 +67,6 @@ struct type9_instance {
     uint16_t slot_id;
     QTAILQ_ENTRY(type9_instance) next;
 };
-static QTAILQ_HEAD(, type9_instance) type9 = QTAILQ_HEAD_INITIALIZER(type9);
-
-static struct {
-    size_t nvalues;
-    char **values;
-} type11;
-
-static struct {
-    const char *loc_pfx, *bank, *manufacturer, *serial, *asset, *part;
-    uint16_t speed;
-} type17;
 
 static QEnumLookup type41_kind_lookup = {
     .array = (const char *const[]) {
@@ -131,7 +88,251 @@ struct type41_instance {
     uint8_t instance, kind;
     QTAILQ_ENTRY(type41_instance) next;
 };
-static QTAILQ_HEAD(, type41_instance) type41 = QTAILQ_HEAD_INITIALIZER(type41);
+
+/* A blob within usr_blobs, keys the index used to drop duplicates */
+typedef struct SmbiosUsrBlob {
+    SmbiosBuilder *b;
+    size_t offset;
+    size_t size;
+} SmbiosUsrBlob;
+
+#define SMBIOS_HANDLE_END 0xFF00 /* 0xFF00 and up are reserved */
+
+/*
+ * Incremental regeneration. The generated structures come in parts whose
+ * inputs change together: the topology feeds the type 4 and 7 parts, the
+ * RAM layout the type 16-20 one, '-smbios type=1,...' the system one.
+ * Each part keeps a copy of what it built last time. A rebuild copies
+ * that in again unless the part was marked dirty since, the machine
+ * state it depends on changed, or its handles would come out
+ * differently, so the result is always the same as a fresh build.
+ * Rebuilds happen at system reset once set-smbios changed types 0-3 or
+ * a CPU or DIMM was plugged or unplugged, see smbios_reset(), and when
+ * SmbiosBuilder users build again. CPU hotplug then only rebuilds the
+ * type 4 part, DIMM hotplug the memory one. Tables the firmware patches
+ * after the build, those
+ * referring to devices behind PCI bridges, and type 38, built from the
+ * IPMI devices, aren't tracked and always rebuilt.
+ */
+typedef enum SmbiosPart {
+    SMBIOS_PART_SYSTEM,     /* types 0-3 */
+    SMBIOS_PART_CPU,        /* type 4 */
+    SMBIOS_PART_CACHE,      /* type 7 */
+    SMBIOS_PART_SLOTS,      /* types 8 and 9 */
+    SMBIOS_PART_OEM,        /* type 11 */
+    SMBIOS_PART_MEM,        /* types 16-20 */
+    SMBIOS_PART_FIXED,      /* types 22-39 */
+    SMBIOS_PART_ONBOARD,    /* type 41 */
+    SMBIOS_PART__MAX
+} SmbiosPart;
+
+#define SMBIOS_PARTS_ALL ((1u << SMBIOS_PART__MAX) - 1)
+
+static const struct {
+    const char *name;
+    const char *types;
+} smbios_part_info[SMBIOS_PART__MAX] = {
+    [SMBIOS_PART_SYSTEM] = { "system", "0-3" },
+    [SMBIOS_PART_CPU] = { "cpu", "4" },
+    [SMBIOS_PART_CACHE] = { "cache", "7" },
+    [SMBIOS_PART_SLOTS] = { "slots", "8,9" },
+    [SMBIOS_PART_OEM] = { "oem", "11" },
+    [SMBIOS_PART_MEM] = { "memory", "16-20" },
+    [SMBIOS_PART_FIXED] = { "fixed", "22-39" },
+    [SMBIOS_PART_ONBOARD] = { "onboard", "41" },
+};
+
+typedef struct SmbiosPartHandle {
+    gpointer key;           /* SMBIOS_HANDLE_KEY() */
+    unsigned handle;
+} SmbiosPartHandle;
+
+typedef struct SmbiosPartState {
+    bool valid;
+    GByteArray *env;        /* machine state the part was built for */
+    GByteArray *data;       /* the structures, as built */
+    GArray *handles;        /* SmbiosPartHandle, every handle they use */
+    unsigned table_max;
+    unsigned table_cnt;
+    unsigned type4_cnt;
+    /* while being built */
+    bool tracked;
+    size_t start;
+    unsigned prev_max;
+    /* cost in the last build, for query-smbios */
+    bool built;             /* ran at all, not the case on cache hits */
+    bool reused;
+    int64_t build_us;
+    unsigned allocs;
+} SmbiosPartState;
+
+/* What the structures of one type cost in the last build, for query-smbios */
+typedef struct SmbiosTypeStats {
+    unsigned structures;    /* built, not reused or loaded from the cache */
+    int64_t build_ns;
+    unsigned allocs;
+} SmbiosTypeStats;
+
+/*
+ * The bus number of a device behind a bridge is only known once the
+ * firmware enumerated the bridges, which happens after the tables are
+ * built. Such bus numbers are patched in whenever the firmware selects
+ * the tables, see smbios_fw_cfg_select(). SeaBIOS numbers the bridges
+ * before it reads the tables, OVMF only after, which is why devices
+ * behind a bridge are refused with uefi=on.
+ */
+typedef struct SmbiosBusFixup {
+    size_t offset;      /* of the bus number in the tables */
+    PCIDevice *pdev;
+} SmbiosBusFixup;
+
+/* A pc-dimm device, described as a memory device of its own */
+typedef struct SmbiosDimm {
+    DeviceState *dev;
+    uint64_t addr;
+    uint64_t size;
+} SmbiosDimm;
+
+/*
+ * Everything needed to build one machine's tables: what the -smbios
+ * options and the board asked for, and the tables built from that.
+ * Builders share nothing, several can be used in parallel as long as
+ * each is used by one thread at a time.
+ */
+struct SmbiosBuilder {
+    SmbiosTables tables;
+    /* tables.data maps a file in share_dir rather than the heap */
+    bool tables_shared;
+    int share_fd;               /* of that file, holds a shared lock on it */
+    char *share_path;
+    Notifier share_exit;
+
+    /* the running machine's: may look at its devices, feeds legacy mode */
+    bool machine;
+
+    bool uuid_encoded;
+    bool uuid_set;
+    QemuUUID uuid;
+    bool have_defaults;
+    uint32_t cpuid_version, cpuid_features;
+    /* directory of previously generated tables, '-smbios cache-dir=' */
+    char *cache_dir;
+    /* tmpfs directory of tables shared between processes, 'share-dir=' */
+    char *share_dir;
+    /* '-smbios migrate=on', the tables travel in the migration stream */
+    bool migrate;
+    /* '-smbios lazy=on', build when the VM first runs */
+    bool lazy;
+
+    /* SMBIOS tables provided by user with '-smbios file=<foo>' option */
+    uint8_t *usr_blobs;
+    size_t usr_blobs_len;
+    size_t usr_blobs_size;
+    unsigned usr_table_max;
+    unsigned usr_table_cnt;
+    GHashTable *usr_blobs_index;
+
+    DECLARE_BITMAP(have_binfile_bitmap, SMBIOS_MAX_TYPE + 1);
+    DECLARE_BITMAP(have_fields_bitmap, SMBIOS_MAX_TYPE + 1);
+
+    smbios_type0_t type0;
+    smbios_type1_t type1;
+
+    struct {
+        const char *manufacturer, *product, *version, *serial, *asset,
+                   *location;
+    } type2;
+
+    struct {
+        const char *manufacturer, *version, *serial, *asset, *sku;
+    } type3;
+
+    struct {
+        uint16_t processor_family;
+        const char *sock_pfx, *manufacturer, *version, *serial, *asset,
+                   *part;
+        uint64_t max_speed;
+        uint64_t current_speed;
+        uint64_t processor_id;
+    } type4;
+
+    QTAILQ_HEAD(, type8_instance) type8;
+    QTAILQ_HEAD(, type9_instance) type9;
+
+    struct {
+        size_t nvalues;
+        char **values;
+    } type11;
+
+    struct {
+        const char *loc_pfx, *bank, *manufacturer, *serial, *asset, *part;
+        uint16_t speed;
+        uint64_t dimm_size;
+    } type17;
+
+    QTAILQ_HEAD(, type41_instance) type41;
+
+    /* plugged pc-dimm devices, see smbios_device_plug() */
+    GArray *dimms;              /* SmbiosDimm, by address */
+
+    /* the last build */
+    SmbiosEntryPoint ep;
+    int type4_count;
+    SmbiosBuildStats stats;
+    SmbiosTypeStats type_stats[SMBIOS_MAX_TYPE + 1];
+    int64_t table_start_ns;     /* of the structure being built */
+    unsigned table_start_allocs;
+    DECLARE_BITMAP(handles_used, SMBIOS_HANDLE_END);
+    unsigned handle_base[SMBIOS_MAX_TYPE + 1];
+    GHashTable *handle_map;
+    Error *handle_err;          /* ran out of handles, fails the build */
+    GArray *bus_fixups;         /* SmbiosBusFixup */
+    GHashTable *str_lens;       /* see smbios_builder_strlen() */
+    unsigned *socket_cores;     /* enabled cores of each socket */
+    SmbiosPartState parts[SMBIOS_PART__MAX];
+    SmbiosPartState *part_cur;
+    unsigned parts_dirty;
+
+    /* rebuilds, deferred builds and migration, see smbios_get_tables() */
+    bool vmstate_registered;
+    VMChangeStateEntry *vm_state_entry;
+    bool reset_registered;
+    bool deferred;              /* fw_cfg only has placeholders */
+    bool staged;                /* set-smbios or hotplug changed something */
+    QemuOpts *staged_opts[4];   /* set-smbios's, for types 0-3 */
+    SmbiosEntryPointType rebuild_ep_type;
+    struct smbios_phys_mem_area *rebuild_mem;
+    unsigned rebuild_mem_size;
+    uint8_t *mig_tables;
+    uint32_t mig_tables_len;
+};
+
+__thread SmbiosTables *smbios_tables;
+
+/*
+ * The builder behind the global smbios_*() functions, the one of the
+ * machine QEMU runs. Legacy mode (smbios_get_table_legacy()) reads its
+ * -smbios settings from the copies below.
+ */
+static SmbiosBuilder *smbios_default;
+
+static SmbiosBuilder *smbios_default_builder(void)
+{
+    if (!smbios_default) {
+        smbios_default = smbios_builder_new();
+        smbios_default->machine = true;
+    }
+    return smbios_default;
+}
+
+uint8_t *usr_blobs;
+size_t usr_blobs_len;
+
+DECLARE_BITMAP(smbios_have_binfile_bitmap, SMBIOS_MAX_TYPE + 1);
+DECLARE_BITMAP(smbios_have_fields_bitmap, SMBIOS_MAX_TYPE + 1);
+
+smbios_type0_t smbios_type0;
+smbios_type1_t smbios_type1;
 
 static QemuOptsList qemu_smbios_opts = {
     .name = "smbios",
@@ -154,6 +355,38 @@ static const QemuOptDesc qemu_smbios_file_opts[] = {
     { /* end of list */ }
 };
 
+static const QemuOptDesc qemu_smbios_cache_opts[] = {
+    {
+        .name = "cache-dir",
+        .type = QEMU_OPT_STRING,
+        .help = "directory caching generated SMBIOS tables",
+    },
+    { /* end of list */ }
+};
+
+static const QemuOptDesc qemu_smbios_share_opts[] = {
+    {
+        .name = "share-dir",
+        .type = QEMU_OPT_STRING,
+        .help = "tmpfs directory sharing identical SMBIOS tables",
+    },
+    { /* end of list */ }
+};
+
+static const QemuOptDesc qemu_smbios_build_opts[] = {
+    {
+        .name = "migrate",
+        .type = QEMU_OPT_BOOL,
+        .help = "send the generated tables along on migration",
+    },
+    {
+        .name = "lazy",
+        .type = QEMU_OPT_BOOL,
+        .help = "generate the tables when the VM first runs",
+    },
+    { /* end of list */ }
+};
+
 static const QemuOptDesc qemu_smbios_type0_opts[] = {
     {
         .name = "type",
@@ -407,7 +640,7 @@ static const QemuOptDesc qemu_smbios_type9_opts[] = {
         .help = "slot characteristics2, see the spec",
     },
     {
-        .name = "pci_device",
+        .name = "pcidev",
         .type = QEMU_OPT_STRING,
         .help = "PCI device, if provided."
     }
@@ -465,6 +698,10 @@ static const QemuOptDesc qemu_smbios_type17_opts[] = {
         .name = "speed",
         .type = QEMU_OPT_NUMBER,
         .help = "maximum capable speed",
+    },{
+        .name = "dimm-size",
+        .type = QEMU_OPT_SIZE,
+        .help = "size of the memory devices RAM is split into",
     },
     { /* end of list */ }
 };
@@ -509,365 +746,1055 @@ opts_init(smbios_register_config);
  */
 #define SMBIOS_21_MAX_TABLES_LEN 0xffff
 
-static bool smbios_check_type4_count(uint32_t expected_t4_count, Error **errp)
+size_t smbios_structure_size(const uint8_t *p, size_t max_len)
+{
+    const struct smbios_structure_header *header =
+        (const struct smbios_structure_header *)p;
+    size_t i = header->length;
+
+    while (i + 1 < max_len && (p[i] || p[i + 1])) {
+        i++;
+    }
+    return i + 2;
+}
+
+static bool smbios_check_type4_count(SmbiosBuilder *b,
+                                     uint32_t expected_t4_count, Error **errp)
 {
-    if (smbios_type4_count && smbios_type4_count != expected_t4_count) {
+    if (b->type4_count && b->type4_count != expected_t4_count) {
         error_setg(errp, "Expected %d SMBIOS Type 4 tables, got %d instead",
-                   expected_t4_count, smbios_type4_count);
+                   expected_t4_count, b->type4_count);
         return false;
     }
     return true;
 }
 
-bool smbios_validate_table(SmbiosEntryPointType ep_type, Error **errp)
+static bool smbios_builder_validate_table(SmbiosBuilder *b,
+                                         SmbiosEntryPointType ep_type,
+                                         Error **errp)
 {
     if (ep_type == SMBIOS_ENTRY_POINT_TYPE_32 &&
-        smbios_tables_len > SMBIOS_21_MAX_TABLES_LEN) {
+        b->tables.len > SMBIOS_21_MAX_TABLES_LEN) {
         error_setg(errp, "SMBIOS 2.1 table length %zu exceeds %d",
-                   smbios_tables_len, SMBIOS_21_MAX_TABLES_LEN);
+                   b->tables.len, SMBIOS_21_MAX_TABLES_LEN);
         return false;
     }
     return true;
 }
 
-bool smbios_skip_table(uint8_t type, bool required_table)
+bool smbios_validate_table(SmbiosEntryPointType ep_type, Error **errp)
 {
-    if (test_bit(type, smbios_have_binfile_bitmap)) {
-        return true; /* user provided their own binary blob(s) */
-    }
-    if (test_bit(type, smbios_have_fields_bitmap)) {
-        return false; /* user provided fields via command line */
-    }
-    if (smbios_have_defaults && required_table) {
-        return false; /* we're building tables, and this one's required */
+    return smbios_builder_validate_table(smbios_default_builder(), ep_type,
+                                         errp);
+}
+
+static SmbiosBuilder *smbios_builder_of(SmbiosTables *tables)
+{
+    return container_of(tables, SmbiosBuilder, tables);
+}
+
+uint8_t *smbios_tables_reserve(size_t len)
+{
+    SmbiosBuilder *b = smbios_builder_of(smbios_tables);
+    size_t need = b->tables.len + len;
+
+    if (need > b->tables.size) {
+        bool in_usr_blobs = b->tables.data == b->usr_blobs;
+
+        b->tables.size = MAX(need, b->tables.size * 2);
+        b->tables.data = g_realloc(b->tables.data, b->tables.size);
+        if (in_usr_blobs) {
+            b->usr_blobs = b->tables.data;
+            b->usr_blobs_size = b->tables.size;
+        }
+        b->stats.allocs++;
+        b->stats.peak_size = MAX(b->stats.peak_size, b->tables.size);
     }
-    return true;
+    return b->tables.data + b->tables.len;
 }
 
-#define T0_BASE 0x000
-#define T1_BASE 0x100
-#define T2_BASE 0x200
-#define T3_BASE 0x300
-#define T4_BASE 0x400
-#define T9_BASE 0x900
-#define T11_BASE 0xe00
-
-#define T7_BASE 0x700 //小迪SEC666 added
-#define T20_BASE 0x1400 //小迪SEC666 added
-#define T22_BASE 0x1600 //小迪SEC666 added
-#define T26_BASE 0x1A00 //小迪SEC666 added
-#define T27_BASE 0x1B00 //小迪SEC666 added
-#define T28_BASE 0x1C00 //小迪SEC666 added
-#define T29_BASE 0x1D00 //小迪SEC666 added
-#define T37_BASE 0x2500 //小迪SEC666 added
-#define T39_BASE 0x2700 //小迪SEC666 added
-
-/* 小迪SEC666 added */
-static struct {
-    const char *socket_designation;
-	QTAILQ_ENTRY(type7) next;
-} type7;
-
-/* 小迪SEC666 added */
-static struct {
-    const char *description;
-	QTAILQ_ENTRY(type26) next;
-} type26;
-
-/* 小迪SEC666 added */
-static struct {
-    const char *description;
-	QTAILQ_ENTRY(type27) next;
-} type27;
-
-/* 小迪SEC666 added */
-static struct {
-    const char *description;
-	QTAILQ_ENTRY(type28) next;
-} type28;
-
-/* SMBIOS type 7 CacheInformation CPU缓存信息 123级cpu缓存 小迪SEC666 added */
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 7 内部参数信息
-static void smbios_build_type_7_table(unsigned instance,const char *socket_designation,uint16_t cache_configuration,uint16_t max_cache_size,uint8_t error_correction,uint8_t system_cache_type,uint8_t associativity)
-{
-	type7.socket_designation=socket_designation;
-	SMBIOS_BUILD_TABLE_PRE(7, T7_BASE + instance, true);
-	SMBIOS_TABLE_SET_STR(7, socket_designation,type7.socket_designation);
-	t->cache_configuration=cache_configuration;
-	t->max_cache_size=max_cache_size;
-	t->installed_size=max_cache_size;
-	t->supported_sram_type=0x20;
-	t->current_sram_type=0x20; //0x20 代表Synchronous
-	t->cache_speed=0x0; //None
-	t->error_correction=error_correction;
-	t->system_cache_type=system_cache_type;
-	t->associativity=associativity;
-	SMBIOS_BUILD_TABLE_POST;
+static void smbios_str_lens_reset(SmbiosBuilder *b)
+{
+    if (!b->str_lens) {
+        b->str_lens = g_hash_table_new(NULL, NULL);
+    } else {
+        g_hash_table_remove_all(b->str_lens);
+    }
 }
 
-/* SMBIOS type 20 MemoryDeviceMappedAddress 内存设备映射地址信息 小迪SEC666 added */
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 20 内部参数信息
-static void smbios_build_type_20_table(uint64_t start, uint64_t size)
+/*
+ * strlen() of the option string @str, interned by address for the rest
+ * of the build: the cache key, the size hint and the structure carrying
+ * it then walk a long OEM string once between them. Only strings that
+ * outlive the build may be interned, a later set-smbios may free them.
+ */
+static size_t smbios_builder_strlen(SmbiosBuilder *b, const char *str)
 {
-	uint64_t end, start_kb, end_kb;
-    end = start + size - 1;
-    assert(end > start);
-    start_kb = start / KiB;
-    end_kb = end/ KiB; 	//小迪SEC666 直接塞进去当前内存大小（不知道是否逻辑正确）
+    gpointer len;
 
-    SMBIOS_BUILD_TABLE_PRE(20, T20_BASE, true); /* required */
-	t->starting_address = cpu_to_le32(start_kb);
-    t->ending_address = cpu_to_le32(end_kb);
-	t->memory_device_handle=0x003C; //查文档
-	t->memory_array_mapped_address_handle=0x0040;//查文档
-	t->partition_row_position=0x1;//查文档
-	t->interleave_position=0x1;//查文档
-	t->interleave_data_depth=0x2;//查文档
-    SMBIOS_BUILD_TABLE_POST;
+    if (!g_hash_table_lookup_extended(b->str_lens, str, NULL, &len)) {
+        len = GSIZE_TO_POINTER(strlen(str));
+        g_hash_table_insert(b->str_lens, (gpointer)str, len);
+    }
+    return GPOINTER_TO_SIZE(len);
 }
 
-/* SMBIOS type 26 VoltageProbe 电压传感器设备信息 小迪SEC666 added*/
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 26 内部参数信息
-static void smbios_build_type_26_table(unsigned instance,const char *description,uint8_t location_and_status)
-{
-	type26.description=description;
-	SMBIOS_BUILD_TABLE_PRE(26, T26_BASE + instance, true);
-	SMBIOS_TABLE_SET_STR(26, description,type26.description);
-	t->location_and_status=location_and_status;
-	t->max_value=0x5800;
-	t->min_value=0x100;
-	t->resolution=0x100;
-	t->tolerance=0x800;
-	t->accuracy=0x10;
-	t->oem_defined=0x00000000;
-	t->nominal_value=0x1000;
-	//小迪SEC666 这些参数你要查一下文档进行设置，我随便设置的
-    SMBIOS_BUILD_TABLE_POST;
+size_t smbios_tables_strlen(const char *str)
+{
+    SmbiosBuilder *b = smbios_builder_of(smbios_tables);
+    gpointer len;
+
+    /* builders also pass formatted buffers, those aren't interned */
+    if (g_hash_table_lookup_extended(b->str_lens, str, NULL, &len)) {
+        return GPOINTER_TO_SIZE(len);
+    }
+    return strlen(str);
 }
 
-/* SMBIOS type 27 CoolingDevice 风扇设备信息 小迪SEC666 added*/
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 27 内部参数信息
-static void smbios_build_type_27_table(unsigned instance,const char *description,uint8_t device_type_and_status)
+#ifdef CONFIG_LINUX
+/*
+ * Unlink shared tables @path, open as @fd, unless some process still
+ * holds its shared lock. Publishers lock a file before linking it in,
+ * others check it is still linked once locked, see smbios_share_lock().
+ */
+static void smbios_share_unlink_unused(int fd, const char *path)
 {
-	type27.description=description;
-	SMBIOS_BUILD_TABLE_PRE(27, T27_BASE + instance, true);
-	t->temperature_probe_handle = cpu_to_le16(0x0029);
-	t->device_type_and_status = device_type_and_status; //Power Supply Fan |  Ok   0x67=b01100111
-	t->cooling_unit_group=0x1;
-	t->OEM_defined=0x00000000;
-	t->nominal_speed=0x5DC; //0x5DC代表1500转
-	//小迪SEC666 这些参数你要查一下文档进行设置，我随便设置的
-	SMBIOS_TABLE_SET_STR(27, description,type27.description);
-    SMBIOS_BUILD_TABLE_POST;
+    struct stat st, path_st;
+
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0 &&
+        fstat(fd, &st) == 0 && stat(path, &path_st) == 0 &&
+        st.st_dev == path_st.st_dev && st.st_ino == path_st.st_ino) {
+        unlink(path);
+    }
 }
 
-/* SMBIOS type 28 TemperatureProbe 温度设备信息 小迪SEC666 added*/
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 28 内部参数信息
-static void smbios_build_type_28_table(unsigned instance,const char *description,uint8_t location_and_status)
-{
-	type28.description=description;
-	SMBIOS_BUILD_TABLE_PRE(28, T28_BASE + instance, true);
-	SMBIOS_TABLE_SET_STR(28, description, type28.description);
-	t->location_and_status=location_and_status;
-	t->maximum_value=0x780;
-	t->minimum_value=0x100;
-	t->resolution=0x1000;
-	t->tolerance=0x800;
-	t->accuracy=0x10;
-	t->OEM_defined=0x00000000;
-	t->nominal_value=0x100;
-	//小迪SEC666 这些参数你要查一下文档进行设置，我随便设置的
-    SMBIOS_BUILD_TABLE_POST;
+/* Stop using the shared tables file, the mapping stays */
+static void smbios_share_release(SmbiosBuilder *b)
+{
+    if (b->share_fd < 0) {
+        return;
+    }
+    smbios_share_unlink_unused(b->share_fd, b->share_path);
+    close(b->share_fd);
+    b->share_fd = -1;
+    g_free(b->share_path);
+    b->share_path = NULL;
 }
 
-/* SMBIOS type 37 MemoryChannel 内存通道信息（这个没有写完） 小迪SEC666 added*/
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 37 内部参数信息
-static void smbios_build_type_37_table(void)
+static void smbios_share_exit(Notifier *n, void *data)
 {
-    SMBIOS_BUILD_TABLE_PRE(37, T37_BASE, true); /* required */
-    SMBIOS_BUILD_TABLE_POST;
+    smbios_share_release(container_of(n, SmbiosBuilder, share_exit));
 }
+#endif
 
-/* SMBIOS type 29 ElectricalCurrentProbe （这个没有写完） 小迪SEC666 added*/
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 29 内部参数信息
-static void smbios_build_type_29_table(void)
+static void smbios_tables_free(SmbiosBuilder *b)
 {
-    SMBIOS_BUILD_TABLE_PRE(29, T29_BASE, true); /* required */
-	SMBIOS_TABLE_SET_STR(29, description,"lixiaoliu Electrical");
-    SMBIOS_BUILD_TABLE_POST;
+    if (b->tables.data == b->usr_blobs) {
+        /* built behind the file= blobs, which stay */
+        b->tables.data = NULL;
+        return;
+    }
+#ifdef CONFIG_LINUX
+    if (b->tables_shared) {
+        smbios_share_release(b);
+        munmap(b->tables.data, b->tables.size);
+        b->tables_shared = false;
+        b->tables.data = NULL;
+        return;
+    }
+#endif
+    g_free(b->tables.data);
+    b->tables.data = NULL;
 }
 
-/* SMBIOS type 39 SystemPowerSupply （这个没有写完） 小迪SEC666 added*/
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 39 内部参数信息
-static void smbios_build_type_39_table(void)
+static void smbios_type_stats_reset(SmbiosBuilder *b)
 {
-    SMBIOS_BUILD_TABLE_PRE(39, T39_BASE, true); /* required */
-	SMBIOS_TABLE_SET_STR(39, device_name,"lixiaoliu PowerSupply");
-    SMBIOS_BUILD_TABLE_POST;
+    memset(b->type_stats, 0, sizeof(b->type_stats));
 }
 
-/* SMBIOS type 22 PortableBattery （这个没有写完） 小迪SEC666 added*/
-//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 22 内部参数信息
-static void smbios_build_type_22_table(void)
+static void smbios_type_stats_begin(SmbiosBuilder *b)
 {
-    SMBIOS_BUILD_TABLE_PRE(22, T22_BASE, true); /* required */
-	SMBIOS_TABLE_SET_STR(22, device_name,"lixiaoliu Battery");
-    SMBIOS_BUILD_TABLE_POST;
+    b->table_start_ns = get_clock();
+    b->table_start_allocs = b->stats.allocs;
 }
-#define T16_BASE 0x1000
-#define T17_BASE 0x1100
-#define T19_BASE 0x1300
-#define T32_BASE 0x2000
-#define T41_BASE 0x2900
-#define T127_BASE 0x7F00
 
-static void smbios_build_type_0_table(void)
+/* Charge what happened since smbios_type_stats_begin() to @type */
+static void smbios_type_stats_end(SmbiosBuilder *b, uint8_t type)
 {
-    SMBIOS_BUILD_TABLE_PRE(0, T0_BASE, false); /* optional, leave up to BIOS */
+    SmbiosTypeStats *ts;
 
-    SMBIOS_TABLE_SET_STR(0, vendor_str, "American Megatrends International LLC.");  //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(0, bios_version_str, "H3.7G");//小迪SEC666 modify
+    if (type > SMBIOS_MAX_TYPE) {
+        return;
+    }
+    ts = &b->type_stats[type];
+    ts->structures++;
+    ts->build_ns += get_clock() - b->table_start_ns;
+    ts->allocs += b->stats.allocs - b->table_start_allocs;
+}
 
-    t->bios_starting_address_segment = cpu_to_le16(0xE800); /* from SeaBIOS */
+void smbios_table_begin(uint8_t type, unsigned instance, uint16_t handle)
+{
+    trace_smbios_table_begin(type, instance, handle);
+    smbios_type_stats_begin(smbios_builder_of(smbios_tables));
+}
 
-    SMBIOS_TABLE_SET_STR(0, bios_release_date_str, "02/21/2023");//小迪SEC666 modify
+void smbios_table_end(size_t t_off, unsigned instance)
+{
+    const struct smbios_structure_header *header =
+        (const struct smbios_structure_header *)(smbios_tables->data + t_off);
 
-    t->bios_rom_size = 0; /* hardcoded in SeaBIOS with FIXME comment */
+    trace_smbios_table_end(header->type, instance,
+                           le16_to_cpu(header->handle),
+                           smbios_tables->len - t_off);
+    smbios_type_stats_end(smbios_builder_of(smbios_tables), header->type);
+}
 
-    t->bios_characteristics = cpu_to_le64(0x08); /* Not supported */
-    t->bios_characteristics_extension_bytes[0] = 0xEF; //小迪SEC666 modify
-    t->bios_characteristics_extension_bytes[1] = 0x0F; /* //小迪SEC666 modify 只要不是0x10 也就是16就不会显示VirtualMachineSupported */
-    if (smbios_type0.uefi) {
-        t->bios_characteristics_extension_bytes[1] |= 0x08; /* |= UEFI */
+static bool smbios_builder_skip_table(SmbiosBuilder *b, uint8_t type,
+                                      bool required_table)
+{
+    if (test_bit(type, b->have_binfile_bitmap)) {
+        return true; /* user provided their own binary blob(s) */
     }
-
-    if (smbios_type0.have_major_minor) {
-        t->system_bios_major_release = smbios_type0.major;
-        t->system_bios_minor_release = smbios_type0.minor;
-    } else {
-        t->system_bios_major_release = 3; //小迪SEC666 modify bios版本号
-        t->system_bios_minor_release = 7; //小迪SEC666 modify bios版本号
+    if (test_bit(type, b->have_fields_bitmap)) {
+        return false; /* user provided fields via command line */
+    }
+    if (b->have_defaults && required_table) {
+        return false; /* we're building tables, and this one's required */
     }
+    return true;
+}
 
-    /* hardcoded in SeaBIOS */
-    t->embedded_controller_major_release = 0xFF;
-    t->embedded_controller_minor_release = 0xFF;
+bool smbios_skip_table(uint8_t type, bool required_table)
+{
+    return smbios_builder_skip_table(smbios_builder_of(smbios_tables), type,
+                                     required_table);
+}
 
-    SMBIOS_BUILD_TABLE_POST;
+static unsigned smbios_type_parts(unsigned type)
+{
+    switch (type) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+        return 1u << SMBIOS_PART_SYSTEM;
+    case 4:
+        return 1u << SMBIOS_PART_CPU;
+    case 8:
+    case 9:
+        return 1u << SMBIOS_PART_SLOTS;
+    case 11:
+        return 1u << SMBIOS_PART_OEM;
+    case 17:
+        return 1u << SMBIOS_PART_MEM;
+    case 41:
+        return 1u << SMBIOS_PART_ONBOARD;
+    default:
+        return SMBIOS_PARTS_ALL;
+    }
 }
 
-/* Encode UUID from the big endian encoding described on RFC4122 to the wire
- * format specified by SMBIOS version 2.6.
+/*
+ * Structure handles. A generated structure is identified by its type and
+ * instance, and gets its handle from smbios_handle() on first use, be it
+ * by its builder or by a structure referring to it, so forward
+ * references resolve to the same value. Handles preferably are
+ * (type << 8) + instance, which keeps ordinary machines laid out as they
+ * always were; when that one is taken, the next free handle is used.
  */
-static void smbios_encode_uuid(struct smbios_uuid *uuid, QemuUUID *in)
+#define T11_HANDLE_BASE 0xe00
+#define T38_HANDLE 0x3000 /* fixed by smbios_build_type_38_table() */
+
+#define SMBIOS_HANDLE_KEY(type, instance) \
+    GUINT_TO_POINTER(((unsigned)(type) << 16) | (instance))
+
+static void smbios_handle_reserve(SmbiosBuilder *b, unsigned handle)
 {
-    memcpy(uuid, in, 16);
-    if (smbios_uuid_encoded) {
-        uuid->time_low = bswap32(uuid->time_low);
-        uuid->time_mid = bswap16(uuid->time_mid);
-        uuid->time_hi_and_version = bswap16(uuid->time_hi_and_version);
+    if (handle < SMBIOS_HANDLE_END) {
+        set_bit(handle, b->handles_used);
     }
 }
 
-static void smbios_build_type_1_table(void)
+/* Forget the handles of the previous build, keep clear of the user's */
+static void smbios_handles_reset(SmbiosBuilder *b)
 {
-    SMBIOS_BUILD_TABLE_PRE(1, T1_BASE, true); /* required */
-
-    SMBIOS_TABLE_SET_STR(1, manufacturer_str, "Maxsun"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(1, product_name_str, "MS-Terminator B760M"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(1, version_str, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(1, serial_number_str, "Default string"); //小迪SEC666 modify
-    if (qemu_uuid_set) {
-        smbios_encode_uuid(&t->uuid, &qemu_uuid);
+    size_t off = 0;
+    unsigned i;
+
+    bitmap_zero(b->handles_used, SMBIOS_HANDLE_END);
+    error_free(b->handle_err);
+    b->handle_err = NULL;
+    if (!b->handle_map) {
+        b->handle_map = g_hash_table_new(NULL, NULL);
     } else {
-        memset(&t->uuid, 0, 16);
+        g_hash_table_remove_all(b->handle_map);
     }
-    t->wake_up_type = 0x06; /* power switch */
-    SMBIOS_TABLE_SET_STR(1, sku_number_str, "Default string"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(1, family_str, "Default string"); //小迪SEC666 modify
 
-    SMBIOS_BUILD_TABLE_POST;
+    for (i = 0; i <= SMBIOS_MAX_TYPE; i++) {
+        b->handle_base[i] = i << 8;
+    }
+    b->handle_base[11] = T11_HANDLE_BASE;
+
+    while (off < b->usr_blobs_len) {
+        const struct smbios_structure_header *header =
+            (const struct smbios_structure_header *)(b->usr_blobs + off);
+
+        smbios_handle_reserve(b, le16_to_cpu(header->handle));
+        off += smbios_structure_size(b->usr_blobs + off,
+                                     b->usr_blobs_len - off);
+    }
+    smbios_handle_reserve(b, T38_HANDLE);
 }
 
-static void smbios_build_type_2_table(void)
+/*
+ * Running out of handles fails the build, but the builders carry on
+ * until smbios_get_tables_ep() notices: they get 0xFFFF, "no structure".
+ */
+static unsigned smbios_handle(SmbiosBuilder *b, uint8_t type, unsigned instance)
 {
-    SMBIOS_BUILD_TABLE_PRE(2, T2_BASE, true); /* optional */
+    gpointer key = SMBIOS_HANDLE_KEY(type, instance);
+    gpointer value;
+    unsigned long handle;
 
-    SMBIOS_TABLE_SET_STR(2, manufacturer_str, "Maxsun"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(2, product_str, "MS-Terminator B760M"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(2, version_str, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(2, serial_number_str, "Default string"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(2, asset_tag_number_str,"Default string"); //小迪SEC666 modify
-    t->feature_flags = 0x01; /* Motherboard */
-    SMBIOS_TABLE_SET_STR(2, location_str,"Default string"); //小迪SEC666 modify
-    t->chassis_handle = cpu_to_le16(0x300); /* Type 3 (System enclosure) */
-    t->board_type = 0x0A; /* Motherboard */
-    t->contained_element_count = 0;
+    if (g_hash_table_lookup_extended(b->handle_map, key, NULL, &value)) {
+        handle = GPOINTER_TO_UINT(value);
+        goto out;
+    }
 
-    SMBIOS_BUILD_TABLE_POST;
+    handle = MIN(b->handle_base[type] + instance, SMBIOS_HANDLE_END);
+    if (handle == SMBIOS_HANDLE_END ||
+        test_bit(handle, b->handles_used)) {
+        handle = find_next_zero_bit(b->handles_used, SMBIOS_HANDLE_END,
+                                    handle);
+        if (handle == SMBIOS_HANDLE_END) {
+            handle = find_next_zero_bit(b->handles_used,
+                                        SMBIOS_HANDLE_END, 0);
+        }
+        if (handle == SMBIOS_HANDLE_END) {
+            if (!b->handle_err) {
+                error_setg(&b->handle_err, "SMBIOS: out of structure handles "
+                           "for type %u instance %u", type, instance);
+            }
+            return 0xFFFF;
+        }
+    }
+
+    set_bit(handle, b->handles_used);
+    g_hash_table_insert(b->handle_map, key, GUINT_TO_POINTER(handle));
+out:
+    trace_smbios_handle(type, instance, handle);
+    if (b->part_cur) {
+        SmbiosPartHandle h = { key, handle };
+
+        g_array_append_val(b->part_cur->handles, h);
+    }
+    return handle;
 }
 
-static void smbios_build_type_3_table(void)
+/*
+ * Allocate the handles @p used last time in the same order again. If
+ * that doesn't give the very same handles, its structures would differ
+ * from a fresh build: undo and fail.
+ */
+static bool smbios_handles_replay(SmbiosBuilder *b, const SmbiosPartState *p)
 {
-    SMBIOS_BUILD_TABLE_PRE(3, T3_BASE, true); /* required */
+    g_autoptr(GArray) added = g_array_new(false, false, sizeof(gpointer));
+    guint i;
 
-    SMBIOS_TABLE_SET_STR(3, manufacturer_str, "Default string"); //小迪SEC666 modify
-    t->type = 0x01; /* Other */
-    SMBIOS_TABLE_SET_STR(3, version_str, "Default string"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(3, serial_number_str, "Default string"); //小迪SEC666 modify
-    SMBIOS_TABLE_SET_STR(3, asset_tag_number_str, "Default string"); //小迪SEC666 modify
-    t->boot_up_state = 0x03; /* Safe */
-    t->power_supply_state = 0x03; /* Safe */
-    t->thermal_state = 0x03; /* Safe */
-    t->security_status = 0x03; /* Unknown */ //小迪SEC666 modify 0x03代表None
-    t->oem_defined = cpu_to_le32(0);
-    t->height = 0;
-    t->number_of_power_cords = 0;
-    t->contained_element_count = 0;
-    t->contained_element_record_length = 0;
-    SMBIOS_TABLE_SET_STR(3, sku_number_str, "Default string"); //小迪SEC666 modify
+    for (i = 0; i < p->handles->len; i++) {
+        SmbiosPartHandle *h = &g_array_index(p->handles, SmbiosPartHandle, i);
+        unsigned key = GPOINTER_TO_UINT(h->key);
 
-    SMBIOS_BUILD_TABLE_POST;
+        if (!g_hash_table_contains(b->handle_map, h->key)) {
+            g_array_append_val(added, h->key);
+        }
+        if (smbios_handle(b, key >> 16, key & 0xffff) != h->handle) {
+            goto undo;
+        }
+    }
+    return true;
+
+undo:
+    for (i = 0; i < added->len; i++) {
+        gpointer key = g_array_index(added, gpointer, i);
+
+        clear_bit(GPOINTER_TO_UINT(g_hash_table_lookup(b->handle_map,
+                                                       key)),
+                  b->handles_used);
+        g_hash_table_remove(b->handle_map, key);
+    }
+    return false;
 }
 
-static void smbios_build_type_4_table(MachineState *ms, unsigned instance,
-                                      SmbiosEntryPointType ep_type,
-                                      Error **errp)
+/* Handle for referring to a structure that may not be generated at all */
+static unsigned smbios_handle_ref(SmbiosBuilder *b, uint8_t type,
+                                  unsigned instance)
 {
-    char sock_str[128];
-    size_t tbl_len = SMBIOS_TYPE_4_LEN_V28;
-    unsigned threads_per_socket;
-    unsigned cores_per_socket;
+    if (smbios_builder_skip_table(b, type, true)) {
+        return 0xFFFF; /* Not provided */
+    }
+    return smbios_handle(b, type, instance);
+}
 
-    if (ep_type == SMBIOS_ENTRY_POINT_TYPE_64) {
-        tbl_len = SMBIOS_TYPE_4_LEN_V30;
+/*
+ * Structures that don't depend on the machine configuration, or only in
+ * a field or two, are laid out at compile time as byte images: the
+ * formatted area immediately followed by its string-set. Adding a probe
+ * or a cache level is a matter of adding a line to one of the lists
+ * below, smbios_build_image_tables() copies them in and patches the
+ * topology dependent fields.
+ */
+#define SMBIOS_IMAGE_STR_MAX 32
+
+typedef struct SmbiosImage {
+    size_t len; /* formatted area + string-set */
+    unsigned instance; /* handle allocated at build time */
+    bool size_per_core; /* type 7: sizes below are per core */
+    union {
+        struct smbios_structure_header header;
+#define SMBIOS_IMAGE_TYPE(tbl_type)                                       \
+        struct {                                                          \
+            struct smbios_type_##tbl_type t;                              \
+            char str[SMBIOS_IMAGE_STR_MAX];                               \
+        } QEMU_PACKED t##tbl_type
+        SMBIOS_IMAGE_TYPE(7);
+        SMBIOS_IMAGE_TYPE(22);
+        SMBIOS_IMAGE_TYPE(26);
+        SMBIOS_IMAGE_TYPE(27);
+        SMBIOS_IMAGE_TYPE(28);
+        SMBIOS_IMAGE_TYPE(29);
+        SMBIOS_IMAGE_TYPE(37);
+        SMBIOS_IMAGE_TYPE(39);
+#undef SMBIOS_IMAGE_TYPE
+        uint8_t data[1];
+    };
+} SmbiosImage;
+
+#define SMBIOS_IMAGE_HEADER(tbl_type)                                     \
+    .header = {                                                           \
+        .type = tbl_type,                                                 \
+        .length = sizeof(struct smbios_type_##tbl_type),                  \
     }
 
-    SMBIOS_BUILD_TABLE_PRE_SIZE(4, T4_BASE + instance,
-                                true, tbl_len); /* required */
+/* a single string, its NUL and the string-set terminator */
+#define SMBIOS_IMAGE_LEN(tbl_type, str)                                   \
+    (sizeof(struct smbios_type_##tbl_type) + sizeof(str) + 1)
+/* no strings, just the double NUL */
+#define SMBIOS_IMAGE_LEN_NOSTR(tbl_type)                                  \
+    (sizeof(struct smbios_type_##tbl_type) + 2)
+
+/* SMBIOS type 7 - Cache Information */
+#define SMBIOS_T7_IMAGE(idx, designation, config, size, per_core,         \
+                        ecc, cache_type, assoc) {                         \
+    .len = SMBIOS_IMAGE_LEN(7, designation),                              \
+    .instance = (idx),                                                    \
+    .size_per_core = per_core,                                            \
+    .t7 = {                                                               \
+        .t = {                                                            \
+            SMBIOS_IMAGE_HEADER(7),                                       \
+            .socket_designation = 1,                                      \
+            .cache_configuration = const_le16(config),                    \
+            .max_cache_size = const_le16(size),                           \
+            .installed_size = const_le16(size),                           \
+            .max_cache_size2 = const_le32(size),                          \
+            .installed_size2 = const_le32(size),                          \
+            .supported_sram_type = const_le16(0x20), /* Synchronous */    \
+            .current_sram_type = const_le16(0x20),                        \
+            .cache_speed = 0, /* Unknown */                               \
+            .error_correction = ecc,                                      \
+            .system_cache_type = cache_type,                              \
+            .associativity = assoc,                                       \
+        },                                                                \
+        .str = designation,                                               \
+    },                                                                    \
+}
 
-    snprintf(sock_str, sizeof(sock_str), "%s%2x", type4.sock_pfx, instance);
+/*
+ * One set per socket. Cache configuration 0x180 + level: write back,
+ * enabled, internal. Sizes are in KB (granularity 1K), L1 and L2 scale
+ * with the cores.
+ */
+static const SmbiosImage smbios_type_7_images[] = {
+    /* L1 data, 32K per core, parity, 8-way */
+    SMBIOS_T7_IMAGE(0, "L1 Cache", 0x180, 0x20, true, 0x4, 0x4, 0x7),
+    /* L1 instruction, 32K per core */
+    SMBIOS_T7_IMAGE(1, "L1 Cache", 0x180, 0x20, true, 0x4, 0x3, 0x7),
+    /* L2 data, 2M per core, single-bit ECC, 16-way */
+    SMBIOS_T7_IMAGE(2, "L2 Cache", 0x181, 0x800, true, 0x5, 0x4, 0x8),
+    /* L2 instruction, 2M per core */
+    SMBIOS_T7_IMAGE(3, "L2 Cache", 0x181, 0x800, true, 0x5, 0x3, 0x8),
+    /* L3 unified, 8M, multi-bit ECC */
+    SMBIOS_T7_IMAGE(4, "L3 Cache", 0x182, 0x2000, false, 0x6, 0x5, 0x8),
+    SMBIOS_T7_IMAGE(5, "L3 Cache", 0x182, 0x2000, false, 0x6, 0x5, 0x8),
+    /* L4 unified, 16M */
+    SMBIOS_T7_IMAGE(6, "lixiaoliu L4 Cache", 0x183, 0x4000, false,
+                    0x6, 0x5, 0x1),
+};
+
+#define SMBIOS_T7_PER_SOCKET ARRAY_SIZE(smbios_type_7_images)
+/* what type 4 links as its L1, L2 and L3 caches, within a socket's set */
+#define SMBIOS_T7_L1 0
+#define SMBIOS_T7_L2 2
+#define SMBIOS_T7_L3 4
+
+/* SMBIOS type 22 - Portable Battery */
+static const SmbiosImage smbios_type_22_images[] = {
+    {
+        .len = SMBIOS_IMAGE_LEN(22, "lixiaoliu Battery"),
+        .t22 = {
+            .t = {
+                SMBIOS_IMAGE_HEADER(22),
+                .device_name = 1,
+            },
+            .str = "lixiaoliu Battery",
+        },
+    },
+};
+
+/* SMBIOS type 26 - Voltage Probe */
+#define SMBIOS_T26_IMAGE(idx, desc, status) {                             \
+    .len = SMBIOS_IMAGE_LEN(26, desc),                                    \
+    .instance = (idx),                                                    \
+    .t26 = {                                                              \
+        .t = {                                                            \
+            SMBIOS_IMAGE_HEADER(26),                                      \
+            .description = 1,                                             \
+            .location_and_status = status,                                \
+            .max_value = const_le16(0x5800),                              \
+            .min_value = const_le16(0x100),                               \
+            .resolution = const_le16(0x100),                              \
+            .tolerance = const_le16(0x800),                               \
+            .accuracy = const_le16(0x10),                                 \
+            .oem_defined = const_le32(0),                                 \
+            .nominal_value = const_le16(0x1000),                          \
+        },                                                                \
+        .str = desc,                                                      \
+    },                                                                    \
+}
+
+/* SMBIOS type 27 - Cooling Device */
+#define SMBIOS_T27_IMAGE(idx, desc, type_status) {                        \
+    .len = SMBIOS_IMAGE_LEN(27, desc),                                    \
+    .instance = (idx),                                                    \
+    .t27 = {                                                              \
+        .t = {                                                            \
+            SMBIOS_IMAGE_HEADER(27),                                      \
+            .device_type_and_status = type_status,                        \
+            .cooling_unit_group = 0x1,                                    \
+            .OEM_defined = const_le32(0),                                 \
+            .nominal_speed = const_le16(1500), /* rpm */                  \
+            .description = 1,                                             \
+        },                                                                \
+        .str = desc,                                                      \
+    },                                                                    \
+}
+
+/* SMBIOS type 28 - Temperature Probe */
+#define SMBIOS_T28_IMAGE(idx, desc, status) {                             \
+    .len = SMBIOS_IMAGE_LEN(28, desc),                                    \
+    .instance = (idx),                                                    \
+    .t28 = {                                                              \
+        .t = {                                                            \
+            SMBIOS_IMAGE_HEADER(28),                                      \
+            .description = 1,                                             \
+            .location_and_status = status,                                \
+            .maximum_value = const_le16(0x780),                           \
+            .minimum_value = const_le16(0x100),                           \
+            .resolution = const_le16(0x1000),                             \
+            .tolerance = const_le16(0x800),                               \
+            .accuracy = const_le16(0x10),                                 \
+            .OEM_defined = const_le32(0),                                 \
+            .nominal_value = const_le16(0x100),                           \
+        },                                                                \
+        .str = desc,                                                      \
+    },                                                                    \
+}
+
+/*
+ * Location and status: bits 7:5 status (011b OK), bits 4:0 location.
+ * Cooling device type and status: bits 7:5 status, bits 4:0 type.
+ * Each cooling device refers to the temperature probe of its instance.
+ */
+static const SmbiosImage smbios_sensor_images[] = {
+    SMBIOS_T26_IMAGE(0, "LM78A", 0x6A),
+    SMBIOS_T26_IMAGE(1, "LM78A", 0x67),
+    SMBIOS_T26_IMAGE(2, "dds666", 0x63),
+    SMBIOS_T26_IMAGE(3, "dds666", 0x64),
+    SMBIOS_T26_IMAGE(4, "lixiaoliu", 0x63),
+    SMBIOS_T26_IMAGE(5, "lixiaoliu", 0x64),
+    SMBIOS_T26_IMAGE(6, "lixiaoliu", 0x6A),
+    SMBIOS_T26_IMAGE(7, "lixiaoliu", 0x67),
+
+    SMBIOS_T27_IMAGE(0, "CPU FAN", 0x67),
+    SMBIOS_T27_IMAGE(1, "dds666", 0x65),
+    SMBIOS_T27_IMAGE(2, "dds666", 0x63),
+    SMBIOS_T27_IMAGE(3, "lixiaoliu", 0x65),
+    SMBIOS_T27_IMAGE(4, "lixiaoliu", 0x63),
+    SMBIOS_T27_IMAGE(5, "lixiaoliu", 0x67),
+
+    SMBIOS_T28_IMAGE(0, "LM78A", 0x63),
+    SMBIOS_T28_IMAGE(1, "LM78A", 0x6A),
+    SMBIOS_T28_IMAGE(2, "dds666", 0x67),
+    SMBIOS_T28_IMAGE(3, "lixiaoliu", 0x67),
+    SMBIOS_T28_IMAGE(4, "lixiaoliu", 0x69),
+    SMBIOS_T28_IMAGE(5, "lixiaoliu", 0x63),
+    SMBIOS_T28_IMAGE(6, "lixiaoliu", 0x6A),
+
+    /* SMBIOS type 29 - Electrical Current Probe */
+    {
+        .len = SMBIOS_IMAGE_LEN(29, "lixiaoliu Electrical"),
+        .t29 = {
+            .t = {
+                SMBIOS_IMAGE_HEADER(29),
+                .description = 1,
+            },
+            .str = "lixiaoliu Electrical",
+        },
+    },
+};
+
+/* SMBIOS type 37 - Memory Channel */
+static const SmbiosImage smbios_type_37_images[] = {
+    {
+        .len = SMBIOS_IMAGE_LEN_NOSTR(37),
+        .t37 = {
+            .t = {
+                SMBIOS_IMAGE_HEADER(37),
+            },
+        },
+    },
+};
+
+/* SMBIOS type 39 - System Power Supply */
+static const SmbiosImage smbios_type_39_images[] = {
+    {
+        .len = SMBIOS_IMAGE_LEN(39, "lixiaoliu PowerSupply"),
+        .t39 = {
+            .t = {
+                SMBIOS_IMAGE_HEADER(39),
+                .device_name = 1,
+            },
+            .str = "lixiaoliu PowerSupply",
+        },
+    },
+};
+
+/*
+ * Set the cache sizes of @t to @kb KB: 1K granularity while that fits the
+ * 15 bits of the original fields, 64K up to 2047M, and past that only the
+ * SMBIOS 3.1 32-bit fields hold the size.
+ */
+static void smbios_type_7_set_size(struct smbios_type_7 *t, uint64_t kb)
+{
+    uint64_t units = DIV_ROUND_UP(kb, 64);
+    uint32_t size2;
+    uint16_t size;
+
+    if (kb <= 0x7FFF) {
+        size = size2 = kb;
+    } else {
+        size = units <= 0x7FFF ? 0x8000 | units : 0xFFFF;
+        size2 = 0x80000000 | MIN(units, 0x7FFFFFFF);
+    }
+    t->max_cache_size = t->installed_size = cpu_to_le16(size);
+    t->max_cache_size2 = t->installed_size2 = cpu_to_le32(size2);
+}
+
+static void smbios_build_image_tables(SmbiosBuilder *b, MachineState *ms,
+                                      const SmbiosImage *images,
+                                      size_t count)
+{
+    unsigned cores_per_socket = machine_topo_get_cores_per_socket(ms);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        const SmbiosImage *img = &images[i];
+        struct smbios_structure_header *header;
+        uint8_t *p;
+
+        if (smbios_builder_skip_table(b, img->header.type, true)) {
+            continue;
+        }
+
+        smbios_type_stats_begin(b);
+        p = smbios_tables_reserve(img->len);
+        memcpy(p, img->data, img->len);
+        b->tables.len += img->len;
+
+        header = (struct smbios_structure_header *)p;
+        header->handle = cpu_to_le16(smbios_handle(b, header->type,
+                                                   img->instance));
+        if (header->type == 27) {
+            struct smbios_type_27 *t = (struct smbios_type_27 *)p;
+
+            t->temperature_probe_handle =
+                cpu_to_le16(smbios_handle_ref(b, 28, img->instance));
+        }
+
+        if (img->size_per_core) {
+            struct smbios_type_7 *t = (struct smbios_type_7 *)p;
+            uint64_t kb = le16_to_cpu(t->max_cache_size);
+
+            smbios_type_7_set_size(t, kb * cores_per_socket);
+        }
+
+        if (img->len > b->tables.max) {
+            b->tables.max = img->len;
+        }
+        b->tables.cnt++;
+        trace_smbios_table_image(header->type, img->instance,
+                                 le16_to_cpu(header->handle), img->len);
+        smbios_type_stats_end(b, header->type);
+    }
+}
+
+/*
+ * Append a copy of the @len bytes long structure at @t_off, a fully built
+ * first instance, as @instance of its type. Returns the copy for the
+ * caller to patch whatever else differs, valid until the next reserve.
+ */
+static void *smbios_clone_table(SmbiosBuilder *b, size_t t_off, size_t len,
+                                unsigned instance)
+{
+    struct smbios_structure_header *header;
+    uint8_t *p;
+
+    smbios_type_stats_begin(b);
+    p = smbios_tables_reserve(len);
+    header = (struct smbios_structure_header *)p;
+    memcpy(p, b->tables.data + t_off, len);
+    header->handle = cpu_to_le16(smbios_handle(b, header->type, instance));
+    b->tables.len += len;
+    b->tables.cnt++;
+    trace_smbios_table_clone(header->type, instance,
+                             le16_to_cpu(header->handle), len);
+    smbios_type_stats_end(b, header->type);
+    return p;
+}
+
+/*
+ * Convert the @count structures at offset @start of the blob, built with
+ * a @from bytes long formatted area, into the older @to bytes long layout
+ * by dropping their trailing fields. Everything behind them moves down
+ * exactly once, bus numbers still to be patched by smbios_fw_cfg_select()
+ * too.
+ */
+static void smbios_shrink_tables(SmbiosBuilder *b, size_t start,
+                                 unsigned count, size_t from, size_t to)
+{
+    size_t src = start, dst = start;
+    unsigned i;
+
+    for (i = 0; i < count; i++) {
+        size_t size = smbios_structure_size(b->tables.data + src,
+                                            b->tables.len - src);
+        struct smbios_structure_header *header;
+
+        memmove(b->tables.data + dst, b->tables.data + src, to);
+        memmove(b->tables.data + dst + to, b->tables.data + src + from,
+                size - from);
+        header = (struct smbios_structure_header *)(b->tables.data + dst);
+        header->length = to;
+
+        src += size;
+        dst += size - (from - to);
+    }
+
+    memmove(b->tables.data + dst, b->tables.data + src,
+            b->tables.len - src);
+    b->tables.len -= src - dst;
+
+    for (i = 0; i < b->bus_fixups->len; i++) {
+        SmbiosBusFixup *fixup = &g_array_index(b->bus_fixups,
+                                               SmbiosBusFixup, i);
+
+        if (fixup->offset >= src) {
+            fixup->offset -= src - dst;
+        }
+    }
+}
+
+/*
+ * Every socket has its own caches. The sets differ only in their
+ * handles: socket 0's is built from the images, the others copy it.
+ */
+static void smbios_build_type_7_tables(SmbiosBuilder *b, MachineState *ms,
+                                       SmbiosEntryPointType ep_type)
+{
+    size_t t_off = b->tables.len, off, size, len;
+    unsigned i, socket, cnt = b->tables.cnt;
+
+    smbios_build_image_tables(b, ms, smbios_type_7_images,
+                              SMBIOS_T7_PER_SOCKET);
+    /*
+     * The images have the 3.1 layout. 2.x has no 32-bit sizes: drop them,
+     * for AUTO smbios_get_tables_ep() does once it settles on 2.1.
+     */
+    if (ep_type == SMBIOS_ENTRY_POINT_TYPE_32) {
+        smbios_shrink_tables(b, t_off, b->tables.cnt - cnt,
+                             SMBIOS_TYPE_7_LEN_V31, SMBIOS_TYPE_7_LEN_V21);
+    }
+    len = b->tables.len - t_off;
+    for (socket = 1; len && socket < ms->smp.sockets; socket++) {
+        for (i = 0, off = t_off; off < t_off + len; i++, off += size) {
+            size = smbios_structure_size(b->tables.data + off,
+                                         t_off + len - off);
+            smbios_clone_table(b, off, size,
+                               socket * SMBIOS_T7_PER_SOCKET +
+                               smbios_type_7_images[i].instance);
+        }
+    }
+}
+
+/* SMBIOS type 20 MemoryDeviceMappedAddress 内存设备映射地址信息 小迪SEC666 added */
+//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 20 内部参数信息
+static void smbios_build_type_20_table(SmbiosBuilder *b, unsigned instance,
+                                       uint64_t start, uint64_t size,
+                                       unsigned device,
+                                       unsigned region)
+{
+	uint64_t end, start_kb, end_kb;
+	bool extended;
+
+    end = start + size - 1;
+    assert(end > start);
+    start_kb = start / KiB;
+    end_kb = end/ KiB; 	//小迪SEC666 直接塞进去当前内存大小（不知道是否逻辑正确）
+    /* keep the short 2.1 layout unless the range needs 64 bit addresses */
+    extended = start_kb >= UINT32_MAX || end_kb >= UINT32_MAX;
+
+    SMBIOS_BUILD_TABLE_PRE_SIZE(20, smbios_handle(b, 20, instance), instance,
+                                true, /* required */
+                                extended ? SMBIOS_TYPE_20_LEN_V27
+                                         : SMBIOS_TYPE_20_LEN_V21);
+    if (!extended) {
+        t->starting_address = cpu_to_le32(start_kb);
+        t->ending_address = cpu_to_le32(end_kb);
+    } else {
+        t->starting_address = t->ending_address = cpu_to_le32(UINT32_MAX);
+        t->extended_starting_address = cpu_to_le64(start);
+        t->extended_ending_address = cpu_to_le64(end);
+    }
+	t->memory_device_handle = cpu_to_le16(smbios_handle(b, 17, device));
+	t->memory_array_mapped_address_handle =
+	    cpu_to_le16(smbios_handle(b, 19, region));
+	t->partition_row_position=0x1;//查文档
+	t->interleave_position=0x1;//查文档
+	t->interleave_data_depth=0x2;//查文档
+    SMBIOS_BUILD_TABLE_POST;
+}
+
+static void smbios_build_type_0_table(SmbiosBuilder *b)
+{
+    SMBIOS_BUILD_TABLE_PRE(0, smbios_handle(b, 0, 0), 0,
+                           false); /* optional, leave up to BIOS */
+
+    SMBIOS_TABLE_SET_STR(0, vendor_str, "American Megatrends International LLC.");  //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(0, bios_version_str, "H3.7G");//小迪SEC666 modify
+
+    t->bios_starting_address_segment = cpu_to_le16(0xE800); /* from SeaBIOS */
+
+    SMBIOS_TABLE_SET_STR(0, bios_release_date_str, "02/21/2023");//小迪SEC666 modify
+
+    t->bios_rom_size = 0; /* hardcoded in SeaBIOS with FIXME comment */
+
+    t->bios_characteristics = cpu_to_le64(0x08); /* Not supported */
+    t->bios_characteristics_extension_bytes[0] = 0xEF; //小迪SEC666 modify
+    t->bios_characteristics_extension_bytes[1] = 0x0F; /* //小迪SEC666 modify 只要不是0x10 也就是16就不会显示VirtualMachineSupported */
+    if (b->type0.uefi) {
+        t->bios_characteristics_extension_bytes[1] |= 0x08; /* |= UEFI */
+    }
+
+    if (b->type0.have_major_minor) {
+        t->system_bios_major_release = b->type0.major;
+        t->system_bios_minor_release = b->type0.minor;
+    } else {
+        t->system_bios_major_release = 3; //小迪SEC666 modify bios版本号
+        t->system_bios_minor_release = 7; //小迪SEC666 modify bios版本号
+    }
+
+    /* hardcoded in SeaBIOS */
+    t->embedded_controller_major_release = 0xFF;
+    t->embedded_controller_minor_release = 0xFF;
+
+    SMBIOS_BUILD_TABLE_POST;
+}
+
+/* Encode UUID from the big endian encoding described on RFC4122 to the wire
+ * format specified by SMBIOS version 2.6.
+ */
+static void smbios_encode_uuid(SmbiosBuilder *b, struct smbios_uuid *uuid,
+                               QemuUUID *in)
+{
+    memcpy(uuid, in, 16);
+    if (b->uuid_encoded) {
+        uuid->time_low = bswap32(uuid->time_low);
+        uuid->time_mid = bswap16(uuid->time_mid);
+        uuid->time_hi_and_version = bswap16(uuid->time_hi_and_version);
+    }
+}
+
+static void smbios_build_type_1_table(SmbiosBuilder *b)
+{
+    SMBIOS_BUILD_TABLE_PRE(1, smbios_handle(b, 1, 0), 0, true); /* required */
+
+    SMBIOS_TABLE_SET_STR(1, manufacturer_str, "Maxsun"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(1, product_name_str, "MS-Terminator B760M"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(1, version_str, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(1, serial_number_str, "Default string"); //小迪SEC666 modify
+    if (b->uuid_set) {
+        smbios_encode_uuid(b, &t->uuid, &b->uuid);
+    } else {
+        memset(&t->uuid, 0, 16);
+    }
+    t->wake_up_type = 0x06; /* power switch */
+    SMBIOS_TABLE_SET_STR(1, sku_number_str, "Default string"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(1, family_str, "Default string"); //小迪SEC666 modify
+
+    SMBIOS_BUILD_TABLE_POST;
+}
+
+static void smbios_build_type_2_table(SmbiosBuilder *b)
+{
+    SMBIOS_BUILD_TABLE_PRE(2, smbios_handle(b, 2, 0), 0, true); /* optional */
+
+    SMBIOS_TABLE_SET_STR(2, manufacturer_str, "Maxsun"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(2, product_str, "MS-Terminator B760M"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(2, version_str, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(2, serial_number_str, "Default string"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(2, asset_tag_number_str,"Default string"); //小迪SEC666 modify
+    t->feature_flags = 0x01; /* Motherboard */
+    SMBIOS_TABLE_SET_STR(2, location_str,"Default string"); //小迪SEC666 modify
+    t->chassis_handle =
+        cpu_to_le16(smbios_handle(b, 3, 0)); /* Type 3 (System enclosure) */
+    t->board_type = 0x0A; /* Motherboard */
+    t->contained_element_count = 0;
+
+    SMBIOS_BUILD_TABLE_POST;
+}
+
+static void smbios_build_type_3_table(SmbiosBuilder *b)
+{
+    SMBIOS_BUILD_TABLE_PRE(3, smbios_handle(b, 3, 0), 0, true); /* required */
+
+    SMBIOS_TABLE_SET_STR(3, manufacturer_str, "Default string"); //小迪SEC666 modify
+    t->type = 0x01; /* Other */
+    SMBIOS_TABLE_SET_STR(3, version_str, "Default string"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(3, serial_number_str, "Default string"); //小迪SEC666 modify
+    SMBIOS_TABLE_SET_STR(3, asset_tag_number_str, "Default string"); //小迪SEC666 modify
+    t->boot_up_state = 0x03; /* Safe */
+    t->power_supply_state = 0x03; /* Safe */
+    t->thermal_state = 0x03; /* Safe */
+    t->security_status = 0x03; /* Unknown */ //小迪SEC666 modify 0x03代表None
+    t->oem_defined = cpu_to_le32(0);
+    t->height = 0;
+    t->number_of_power_cords = 0;
+    t->contained_element_count = 0;
+    t->contained_element_record_length = 0;
+    SMBIOS_TABLE_SET_STR(3, sku_number_str, "Default string"); //小迪SEC666 modify
+
+    SMBIOS_BUILD_TABLE_POST;
+}
+
+/* Link @t to the caches of @socket */
+static void smbios_type_4_set_caches(SmbiosBuilder *b, struct smbios_type_4 *t,
+                                     unsigned socket)
+{
+    unsigned base = socket * SMBIOS_T7_PER_SOCKET;
+
+    t->l1_cache_handle =
+        cpu_to_le16(smbios_handle_ref(b, 7, base + SMBIOS_T7_L1));
+    t->l2_cache_handle =
+        cpu_to_le16(smbios_handle_ref(b, 7, base + SMBIOS_T7_L2));
+    t->l3_cache_handle =
+        cpu_to_le16(smbios_handle_ref(b, 7, base + SMBIOS_T7_L3));
+}
+
+/*
+ * Count the enabled cores of each socket into socket_cores. CPUs are
+ * plugged a thread at a time into the slots of ms->possible_cpus, the
+ * threads present are rounded up to whole cores. Machines without
+ * slots, as the tools', have every socket full.
+ */
+static void smbios_socket_cores_update(SmbiosBuilder *b, MachineState *ms)
+{
+    unsigned cores_per_socket = machine_topo_get_cores_per_socket(ms);
+    const CPUArchIdList *slots = b->machine ? ms->possible_cpus : NULL;
+    unsigned i;
+
+    b->socket_cores = g_renew(unsigned, b->socket_cores, ms->smp.sockets);
+    if (!slots) {
+        for (i = 0; i < ms->smp.sockets; i++) {
+            b->socket_cores[i] = cores_per_socket;
+        }
+        return;
+    }
+
+    memset(b->socket_cores, 0, ms->smp.sockets * sizeof(*b->socket_cores));
+    for (i = 0; i < slots->len; i++) {
+        const CPUArchId *slot = &slots->cpus[i];
+
+        if (slot->cpu && slot->props.has_socket_id &&
+            slot->props.socket_id < ms->smp.sockets) {
+            b->socket_cores[slot->props.socket_id]++;
+        }
+    }
+    for (i = 0; i < ms->smp.sockets; i++) {
+        b->socket_cores[i] = DIV_ROUND_UP(b->socket_cores[i], ms->smp.threads);
+    }
+}
+
+/* Describe @t's socket as holding @cores enabled cores, or as empty */
+static void smbios_type_4_set_enabled(struct smbios_type_4 *t, unsigned cores)
+{
+    /* Socket populated, CPU enabled; or Socket unpopulated */
+    t->status = cores ? 0x41 : 0x00;
+    t->core_enabled = MIN(cores, 0xFF);
+    if (t->header.length >= SMBIOS_TYPE_4_LEN_V30) {
+        t->core_enabled2 = cpu_to_le16(cores);
+    }
+}
+
+static void smbios_build_type_4_table(SmbiosBuilder *b, MachineState *ms,
+                                      unsigned instance,
+                                      SmbiosEntryPointType ep_type,
+                                      Error **errp)
+{
+    char sock_str[128];
+    size_t tbl_len = SMBIOS_TYPE_4_LEN_V28;
+    unsigned threads_per_socket;
+    unsigned cores_per_socket;
+
+    /*
+     * AUTO builds the 3.0 layout too, smbios_get_tables_ep() shrinks it
+     * back to 2.8 once it knows the 2.1 entry point will do.
+     */
+    if (ep_type != SMBIOS_ENTRY_POINT_TYPE_32) {
+        tbl_len = SMBIOS_TYPE_4_LEN_V30;
+    }
+
+    SMBIOS_BUILD_TABLE_PRE_SIZE(4, smbios_handle(b, 4, instance), instance,
+                                true, tbl_len); /* required */
+
+    snprintf(sock_str, sizeof(sock_str), "%s%2x", b->type4.sock_pfx, instance);
     SMBIOS_TABLE_SET_STR(4, socket_designation_str, "LGA1700"); //小迪SEC666 modify 直接改成12代的LGA1700 接口
     t->processor_type = 0x03; /* CPU */
     t->processor_family = 0xC6; /* use Processor Family 2 field */ //小迪SEC666 modify 0xC6代表 Intel® Core™ i7 processor
     SMBIOS_TABLE_SET_STR(4, processor_manufacturer_str, "Intel(R) Corporation"); //小迪SEC666 modify
-    if (type4.processor_id == 0) {
-        t->processor_id[0] = cpu_to_le32(smbios_cpuid_version);
-        t->processor_id[1] = cpu_to_le32(smbios_cpuid_features);
+    if (b->type4.processor_id == 0) {
+        t->processor_id[0] = cpu_to_le32(b->cpuid_version);
+        t->processor_id[1] = cpu_to_le32(b->cpuid_features);
     } else {
-        t->processor_id[0] = cpu_to_le32((uint32_t)type4.processor_id);
-        t->processor_id[1] = cpu_to_le32(type4.processor_id >> 32);
+        t->processor_id[0] = cpu_to_le32((uint32_t)b->type4.processor_id);
+        t->processor_id[1] = cpu_to_le32(b->type4.processor_id >> 32);
     }
     SMBIOS_TABLE_SET_STR(4, processor_version_str, "12th Gen Intel(R) Core(TM) i7"); //小迪SEC666 modify
     t->voltage = 0x8B;
     t->external_clock = cpu_to_le16(100); /* Unknown */ //小迪SEC666 modify 外频100mhz
     t->max_speed = cpu_to_le16(4900); //小迪SEC666 modify 最大频率4.9gzh
     t->current_speed = cpu_to_le16(4455); //小迪SEC666 modify 当前频率4455mhz
-    t->status = 0x41; /* Socket populated, CPU enabled */
     t->processor_upgrade = 0x01; /* Other */
-    t->l1_cache_handle = cpu_to_le16(0x0051); /* N/A */ //小迪SEC666 modify L1缓存抄写物理机
-    t->l2_cache_handle = cpu_to_le16(0x0052); /* N/A */ //小迪SEC666 modify L2缓存抄写物理机
-    t->l3_cache_handle = cpu_to_le16(0x0053); /* N/A */ //小迪SEC666 modify L3缓存抄写物理机
+    smbios_type_4_set_caches(b, t, instance);
     SMBIOS_TABLE_SET_STR(4, serial_number_str, "To Be Filled By O.E.M."); //小迪SEC666
     SMBIOS_TABLE_SET_STR(4, asset_tag_number_str, "To Be Filled By O.E.M."); //小迪SEC666
     SMBIOS_TABLE_SET_STR(4, part_number_str, "To Be Filled By O.E.M."); //小迪SEC666
@@ -876,7 +1803,6 @@ static void smbios_build_type_4_table(MachineState *ms, unsigned instance,
     cores_per_socket = machine_topo_get_cores_per_socket(ms);
 
     t->core_count = (cores_per_socket > 255) ? 0xFF : cores_per_socket;
-    t->core_enabled = t->core_count;
 
     t->thread_count = (threads_per_socket > 255) ? 0xFF : threads_per_socket;
 
@@ -884,7 +1810,7 @@ static void smbios_build_type_4_table(MachineState *ms, unsigned instance,
     t->processor_family2 = cpu_to_le16(0xC6); //小迪SEC666 modify 和t->processor_family保持一致不一致都可以
 
     if (tbl_len == SMBIOS_TYPE_4_LEN_V30) {
-        t->core_count2 = t->core_enabled2 = cpu_to_le16(cores_per_socket);
+        t->core_count2 = cpu_to_le16(cores_per_socket);
         t->thread_count2 = cpu_to_le16(threads_per_socket);
     } else if (t->core_count == 0xFF || t->thread_count == 0xFF) {
         error_setg(errp, "SMBIOS 2.0 doesn't support number of processor "
@@ -893,18 +1819,46 @@ static void smbios_build_type_4_table(MachineState *ms, unsigned instance,
                          "SMBIOS 3.0 support");
         return;
     }
+    smbios_type_4_set_enabled(t, b->socket_cores[instance]);
 
     SMBIOS_BUILD_TABLE_POST;
-    smbios_type4_count++;
+    b->type4_count++;
+}
+
+/*
+ * The sockets only differ in their handles and enabled cores: build the
+ * first one and stamp out copies of it for the others.
+ */
+static void smbios_build_type_4_tables(SmbiosBuilder *b, MachineState *ms,
+                                       SmbiosEntryPointType ep_type,
+                                       Error **errp)
+{
+    size_t t_off = b->tables.len, len;
+    unsigned i;
+    ERRP_GUARD();
+
+    smbios_build_type_4_table(b, ms, 0, ep_type, errp);
+    len = b->tables.len - t_off;
+    if (*errp || !len) {
+        return;
+    }
+    for (i = 1; i < ms->smp.sockets; i++) {
+        struct smbios_type_4 *t = smbios_clone_table(b, t_off, len, i);
+
+        smbios_type_4_set_caches(b, t, i);
+        smbios_type_4_set_enabled(t, b->socket_cores[i]);
+        b->type4_count++;
+    }
 }
 
-static void smbios_build_type_8_table(void)
+static void smbios_build_type_8_table(SmbiosBuilder *b)
 {
     unsigned instance = 0;
     struct type8_instance *t8;
 
-    QTAILQ_FOREACH(t8, &type8, next) {
-        SMBIOS_BUILD_TABLE_PRE(8, T0_BASE + instance, true);
+    QTAILQ_FOREACH(t8, &b->type8, next) {
+        SMBIOS_BUILD_TABLE_PRE(8, smbios_handle(b, 8, instance), instance,
+                               true);
 
         SMBIOS_TABLE_SET_STR(8, internal_reference_str, "FAN"); //小迪SEC666 modify
         SMBIOS_TABLE_SET_STR(8, external_reference_str, "CPU FAN"); //小迪SEC666 modify
@@ -918,47 +1872,116 @@ static void smbios_build_type_8_table(void)
     }
 }
 
-static void smbios_build_type_9_table(Error **errp)
+/*
+ * User created devices are found by id in /machine/peripheral, which QOM
+ * keeps hashed, rather than by walking every PCI bus for each entry.
+ */
+static PCIDevice *smbios_find_pcidev(SmbiosBuilder *b, const char *id)
 {
-    unsigned instance = 0;
-    struct type9_instance *t9;
+    Object *obj;
 
-    QTAILQ_FOREACH(t9, &type9, next) {
-        SMBIOS_BUILD_TABLE_PRE(9, T9_BASE + instance, true);
+    if (!b->machine) {
+        return NULL;
+    }
+    obj = object_resolve_path_component(
+        container_get(qdev_get_machine(), "/peripheral"), id);
 
-        SMBIOS_TABLE_SET_STR(9, slot_designation, t9->slot_designation);
-        t->slot_type = t9->slot_type;
-        t->slot_data_bus_width = t9->slot_data_bus_width;
-        t->current_usage = t9->current_usage;
+    return (PCIDevice *)object_dynamic_cast(obj, TYPE_PCI_DEVICE);
+}
+
+static void smbios_bus_fixups_reset(SmbiosBuilder *b)
+{
+    guint i;
+
+    if (!b->bus_fixups) {
+        b->bus_fixups = g_array_new(false, false, sizeof(SmbiosBusFixup));
+    }
+    for (i = 0; i < b->bus_fixups->len; i++) {
+        object_unref(OBJECT(g_array_index(b->bus_fixups,
+                                          SmbiosBusFixup, i).pdev));
+    }
+    g_array_set_size(b->bus_fixups, 0);
+}
+
+static bool smbios_set_bus_number(SmbiosBuilder *b, size_t offset,
+                                  uint8_t type, const char *pcidev,
+                                  PCIDevice *pdev, Error **errp)
+{
+    if (!pci_bus_is_root(pci_get_bus(pdev))) {
+        SmbiosBusFixup fixup = { offset, pdev };
+
+        if (b->type0.uefi) {
+            error_setg(errp,
+                       "Cannot create type %d entry for PCI device %s: "
+                       "not attached to the root bus, and UEFI firmware "
+                       "reads the tables before it numbers the bridges",
+                       type, pcidev);
+            return false;
+        }
+        object_ref(OBJECT(pdev));
+        g_array_append_val(b->bus_fixups, fixup);
+    }
+    b->tables.data[offset] = pci_dev_bus_num(pdev);
+    return true;
+}
+
+/*
+ * The board registers this for "etc/smbios/smbios-tables" without an
+ * opaque, which fw_cfg_modify_file() would drop anyway when the tables
+ * are rebuilt: the file always holds the default builder's tables.
+ */
+void smbios_fw_cfg_select(void *opaque)
+{
+    SmbiosBuilder *b = smbios_default;
+    guint i;
+
+    if (!b) {
+        return;
+    }
+    for (i = 0; b->bus_fixups && i < b->bus_fixups->len; i++) {
+        SmbiosBusFixup *fixup = &g_array_index(b->bus_fixups,
+                                               SmbiosBusFixup, i);
+
+        /* unplugged since, leave the last bus number we saw */
+        if (qdev_is_realized(DEVICE(fixup->pdev))) {
+            b->tables.data[fixup->offset] = pci_dev_bus_num(fixup->pdev);
+        }
+    }
+}
+
+static void smbios_build_type_9_table(SmbiosBuilder *b, Error **errp)
+{
+    unsigned instance = 0;
+    struct type9_instance *t9;
+
+    QTAILQ_FOREACH(t9, &b->type9, next) {
+        SMBIOS_BUILD_TABLE_PRE(9, smbios_handle(b, 9, instance), instance,
+                               true);
+
+        SMBIOS_TABLE_SET_STR(9, slot_designation, t9->slot_designation);
+        t->slot_type = t9->slot_type;
+        t->slot_data_bus_width = t9->slot_data_bus_width;
+        t->current_usage = t9->current_usage;
         t->slot_length = t9->slot_length;
         t->slot_id = t9->slot_id;
         t->slot_characteristics1 = t9->slot_characteristics1;
         t->slot_characteristics2 = t9->slot_characteristics2;
 
         if (t9->pcidev) {
-            PCIDevice *pdev = NULL;
-            int rc = pci_qdev_find_device(t9->pcidev, &pdev);
-            if (rc != 0) {
+            PCIDevice *pdev = smbios_find_pcidev(b, t9->pcidev);
+            if (!pdev) {
                 error_setg(errp,
                            "No PCI device %s for SMBIOS type 9 entry %s",
                            t9->pcidev, t9->slot_designation);
                 return;
             }
-            /*
-             * We only handle the case were the device is attached to
-             * the PCI root bus. The general case is more complex as
-             * bridges are enumerated later and the table would need
-             * to be updated at this moment.
-             */
-            if (!pci_bus_is_root(pci_get_bus(pdev))) {
-                error_setg(errp,
-                           "Cannot create type 9 entry for PCI device %s: "
-                           "not attached to the root bus",
-                           t9->pcidev);
+            t->segment_group_number = cpu_to_le16(0);
+            if (!smbios_set_bus_number(b, t_off +
+                                       offsetof(struct smbios_type_9,
+                                                bus_number),
+                                       9, t9->pcidev, pdev, errp)) {
                 return;
             }
-            t->segment_group_number = cpu_to_le16(0);
-            t->bus_number = pci_dev_bus_num(pdev);
             t->device_number = pdev->devfn;
         } else {
             /*
@@ -977,46 +2000,70 @@ static void smbios_build_type_9_table(Error **errp)
     }
 }
 
-static void smbios_build_type_11_table(void)
+/* String numbers are a byte, a structure can't hold more strings */
+#define SMBIOS_T11_MAX_STRINGS 255
+
+/*
+ * Build one type 11 structure from the OEM strings at *@next onwards and
+ * advance *@next past the ones it took. Empty values are not strings.
+ */
+static void smbios_build_type_11_part(SmbiosBuilder *b, unsigned instance,
+                                      size_t *next)
 {
-    char count_str[128];
-    size_t i;
-    if (type11.nvalues == 0) {
-        return;
+    size_t i = *next;
+
+    SMBIOS_BUILD_TABLE_PRE(11, smbios_handle(b, 11, instance), instance,
+                           true); /* required */
+
+    while (i < b->type11.nvalues && str_index < SMBIOS_T11_MAX_STRINGS) {
+        SMBIOS_TABLE_SET_STR_LIST(11, b->type11.values[i]);
+        i++;
     }
+    t->count = str_index;
+    *next = i;
 
-    SMBIOS_BUILD_TABLE_PRE(11, T11_BASE, true); /* required */
+    SMBIOS_BUILD_TABLE_POST;
+}
 
-    snprintf(count_str, sizeof(count_str), "%zu", type11.nvalues);
-    t->count = type11.nvalues;
+static void smbios_build_type_11_table(SmbiosBuilder *b)
+{
+    unsigned instance = 0;
+    size_t next = 0;
 
-    for (i = 0; i < type11.nvalues; i++) {
-        SMBIOS_TABLE_SET_STR_LIST(11, type11.values[i]);
-        g_free(type11.values[i]);
-        type11.values[i] = NULL;
+    if (smbios_builder_skip_table(b, 11, true)) {
+        return;
     }
 
-    SMBIOS_BUILD_TABLE_POST;
+    while (1) {
+        while (next < b->type11.nvalues && !*b->type11.values[next]) {
+            next++;
+        }
+        if (next == b->type11.nvalues) {
+            break;
+        }
+        smbios_build_type_11_part(b, instance++, &next);
+    }
 }
 
 #define MAX_T16_STD_SZ 0x80000000 /* 2T in Kilobytes */
 
-static void smbios_build_type_16_table(unsigned dimm_cnt)
+static void smbios_build_type_16_table(SmbiosBuilder *b, uint64_t ram_size,
+                                       unsigned dimm_cnt)
 {
     uint64_t size_kb;
 
-    SMBIOS_BUILD_TABLE_PRE(16, T16_BASE, true); /* required */
+    SMBIOS_BUILD_TABLE_PRE(16, smbios_handle(b, 16, 0), 0, true); /* required */
 
     t->location = 0x03; /* Other */ //小迪SEC666 modify 0x03代表 System board or motherboard
     t->use = 0x03; /* System memory */
     t->error_correction = 0x03; /* Multi-bit ECC (for Microsoft, per SeaBIOS) */ //小迪SEC666 modify 0x03代表 None
-    size_kb = QEMU_ALIGN_UP(current_machine->ram_size, KiB) / KiB;
+    size_kb = QEMU_ALIGN_UP(ram_size, KiB) / KiB;
     if (size_kb < MAX_T16_STD_SZ) {
         t->maximum_capacity = cpu_to_le32(size_kb);
         t->extended_maximum_capacity = cpu_to_le64(0);
     } else {
         t->maximum_capacity = cpu_to_le32(MAX_T16_STD_SZ);
-        t->extended_maximum_capacity = cpu_to_le64(current_machine->ram_size);
+        t->extended_maximum_capacity = cpu_to_le64(ram_size);
     }
     t->memory_error_information_handle = cpu_to_le16(0xFFFE); /* Not provided */
     t->number_of_memory_devices = cpu_to_le16(dimm_cnt);
@@ -1027,18 +2074,10 @@ static void smbios_build_type_16_table(unsigned dimm_cnt)
 #define MAX_T17_STD_SZ 0x7FFF /* (32G - 1M), in Megabytes */
 #define MAX_T17_EXT_SZ 0x80000000 /* 2P, in Megabytes */
 
-static void smbios_build_type_17_table(unsigned instance, uint64_t size)
+static void smbios_type_17_set_size(struct smbios_type_17 *t, uint64_t size)
 {
-    char loc_str[128];
-    uint64_t size_mb;
+    uint64_t size_mb = QEMU_ALIGN_UP(size, MiB) / MiB;
 
-    SMBIOS_BUILD_TABLE_PRE(17, T17_BASE + instance, true); /* required */
-
-    t->physical_memory_array_handle = cpu_to_le16(0x1000); /* Type 16 above */
-    t->memory_error_information_handle = cpu_to_le16(0xFFFE); /* Not provided */
-    t->total_width = cpu_to_le16(64); /* Unknown */ //小迪SEC666 modify 64位
-    t->data_width = cpu_to_le16(64); /* Unknown */  //小迪SEC666 modify 64位
-    size_mb = QEMU_ALIGN_UP(size, MiB) / MiB;
     if (size_mb < MAX_T17_STD_SZ) {
         t->size = cpu_to_le16(size_mb);
         t->extended_size = cpu_to_le32(0);
@@ -1047,9 +2086,25 @@ static void smbios_build_type_17_table(unsigned instance, uint64_t size)
         t->size = cpu_to_le16(MAX_T17_STD_SZ);
         t->extended_size = cpu_to_le32(size_mb);
     }
+}
+
+static void smbios_build_type_17_table(SmbiosBuilder *b, unsigned instance,
+                                       uint64_t size)
+{
+    char loc_str[128];
+
+    SMBIOS_BUILD_TABLE_PRE(17, smbios_handle(b, 17, instance), instance,
+                           true); /* required */
+
+    t->physical_memory_array_handle =
+        cpu_to_le16(smbios_handle(b, 16, 0)); /* Type 16 above */
+    t->memory_error_information_handle = cpu_to_le16(0xFFFE); /* Not provided */
+    t->total_width = cpu_to_le16(64); /* Unknown */ //小迪SEC666 modify 64位
+    t->data_width = cpu_to_le16(64); /* Unknown */  //小迪SEC666 modify 64位
+    smbios_type_17_set_size(t, size);
     t->form_factor = 0x09; /* DIMM */
     t->device_set = 0; /* Not in a set */
-    snprintf(loc_str, sizeof(loc_str), "%s %d", type17.loc_pfx, instance);
+    snprintf(loc_str, sizeof(loc_str), "%s %d", b->type17.loc_pfx, instance);
     SMBIOS_TABLE_SET_STR(17, device_locator_str, "Controller0-ChannelA-DIMM0");   //小迪SEC666 modify 内存设备位置
     SMBIOS_TABLE_SET_STR(17, bank_locator_str, "BANK 0");  //小迪SEC666 modify 内存插槽位置
     t->memory_type = 0x1A; /* DDR4 */  //小迪SEC666 modify ddr4类型
@@ -1068,12 +2123,12 @@ static void smbios_build_type_17_table(unsigned instance, uint64_t size)
     SMBIOS_BUILD_TABLE_POST;
 }
 
-static void smbios_build_type_19_table(unsigned instance, unsigned offset,
+static void smbios_build_type_19_table(SmbiosBuilder *b, unsigned instance,
                                        uint64_t start, uint64_t size)
 {
     uint64_t end, start_kb, end_kb;
 
-    SMBIOS_BUILD_TABLE_PRE(19, T19_BASE + offset + instance,
+    SMBIOS_BUILD_TABLE_PRE(19, smbios_handle(b, 19, instance), instance,
                            true); /* required */
 
     end = start + size - 1;
@@ -1090,168 +2145,1680 @@ static void smbios_build_type_19_table(unsigned instance, unsigned offset,
         t->extended_starting_address = cpu_to_le64(start);
         t->extended_ending_address = cpu_to_le64(end);
     }
-    t->memory_array_handle = cpu_to_le16(0x1000); /* Type 16 above */
+    t->memory_array_handle =
+        cpu_to_le16(smbios_handle(b, 16, 0)); /* Type 16 above */
     t->partition_width = 1; /* One device per row */
 
     SMBIOS_BUILD_TABLE_POST;
 }
 
-static void smbios_build_type_32_table(void)
+#define MAX_DIMM_SZ (16 * GiB) /* default memory device granularity */
+
+/*
+ * The memory device (17) and mapped address (19, 20) structures keep
+ * their traditional handles while these don't run into the next type.
+ * Larger guests get them from a window of their own above type 127.
+ */
+#define TMEM_EXT_BASE 0x8000
+
+typedef struct SmbiosMemLayout {
+    uint64_t ram_size;
+    uint64_t dimm_sz;
+    unsigned dimm_cnt;
+    unsigned region_cnt;    /* type 19 structures */
+    unsigned map_max;       /* upper bound of type 20 structures */
+    /* pc-dimm devices, described after those RAM is split into */
+    const SmbiosDimm *plugged;
+    unsigned plugged_cnt;
+    uint64_t plugged_size;
+} SmbiosMemLayout;
+
+/*
+ * Split RAM into memory devices of type17.dimm_size (16 GiB by default),
+ * doubling the granularity until all of their structures get a handle.
+ * Every device maps into at most all regions it straddles, so there are
+ * fewer type 20 structures than devices and regions together. Plugged
+ * DIMMs come after, each a device, region and mapping of its own.
+ */
+static void smbios_mem_layout(SmbiosBuilder *b, SmbiosMemLayout *l,
+                              uint64_t ram_size,
+                              const struct smbios_phys_mem_area *mem_array,
+                              const unsigned int mem_array_size)
+{
+    unsigned i;
+
+    l->ram_size = ram_size;
+    l->plugged = (const SmbiosDimm *)b->dimms->data;
+    l->plugged_cnt = b->dimms->len;
+    l->plugged_size = 0;
+    for (i = 0; i < l->plugged_cnt; i++) {
+        l->plugged_size += l->plugged[i].size;
+    }
+    l->region_cnt = 0;
+    for (i = 0; i < mem_array_size; i++) {
+        if (mem_array[i].length) {
+            l->region_cnt++;
+        }
+    }
+
+    l->dimm_sz = b->type17.dimm_size ? b->type17.dimm_size : MAX_DIMM_SZ;
+    for (;;) {
+        l->dimm_cnt = DIV_ROUND_UP(ram_size, l->dimm_sz);
+        l->map_max = l->dimm_cnt + l->region_cnt;
+        if ((uint64_t)l->dimm_cnt + l->region_cnt + l->map_max +
+            3 * l->plugged_cnt <= SMBIOS_HANDLE_END - TMEM_EXT_BASE) {
+            break;
+        }
+        l->dimm_sz *= 2;
+    }
+    if (b->type17.dimm_size && l->dimm_sz != b->type17.dimm_size) {
+        warn_report("SMBIOS: dimm-size too small for %" PRIu64
+                    " bytes of RAM, using %" PRIu64 " bytes",
+                    ram_size, l->dimm_sz);
+    }
+
+    if (l->dimm_cnt + l->plugged_cnt >
+        b->handle_base[19] - b->handle_base[17] ||
+        l->region_cnt + l->plugged_cnt >
+        b->handle_base[20] - b->handle_base[19] ||
+        l->map_max + l->plugged_cnt >
+        b->handle_base[22] - b->handle_base[20]) {
+        b->handle_base[17] = TMEM_EXT_BASE;
+        b->handle_base[19] = b->handle_base[17] + l->dimm_cnt +
+                             l->plugged_cnt;
+        b->handle_base[20] = b->handle_base[19] + l->region_cnt +
+                             l->plugged_cnt;
+    }
+}
+
+static uint64_t smbios_dimm_size(const SmbiosMemLayout *l, unsigned i)
+{
+    if (i >= l->dimm_cnt) {
+        return l->plugged[i - l->dimm_cnt].size;
+    }
+    if (i < l->dimm_cnt - 1) {
+        return l->dimm_sz;
+    }
+    return ((l->ram_size - 1) % l->dimm_sz) + 1;
+}
+
+/*
+ * Build the memory array (16), its devices (17), one mapped address
+ * structure (19) per RAM region and the device mapped addresses (20)
+ * of the devices laid out back to back over those regions.
+ */
+static void smbios_build_mem_tables(SmbiosBuilder *b, const SmbiosMemLayout *l,
+                        const struct smbios_phys_mem_area *mem_array,
+                        const unsigned int mem_array_size)
+{
+    unsigned i, region = 0, map = 0, dimm = 0;
+    uint64_t dimm_off = 0;
+    size_t t_off, len;
+
+    smbios_build_type_16_table(b, l->ram_size + l->plugged_size,
+                               l->dimm_cnt + l->plugged_cnt);
+    if (!l->dimm_cnt && !l->plugged_cnt) {
+        /* no RAM, so no devices to describe or map */
+        return;
+    }
+
+    /* the devices only differ in handle and size, see type 4 */
+    t_off = b->tables.len;
+    smbios_build_type_17_table(b, 0, smbios_dimm_size(l, 0));
+    len = b->tables.len - t_off;
+    for (i = 1; len && i < l->dimm_cnt + l->plugged_cnt; i++) {
+        smbios_type_17_set_size(smbios_clone_table(b, t_off, len, i),
+                                smbios_dimm_size(l, i));
+    }
+
+    for (i = 0; i < mem_array_size; i++) {
+        if (mem_array[i].length) {
+            smbios_build_type_19_table(b, region++,
+                                       mem_array[i].address,
+                                       mem_array[i].length);
+        }
+    }
+    for (i = 0; i < l->plugged_cnt; i++) {
+        smbios_build_type_19_table(b, l->region_cnt + i, l->plugged[i].addr,
+                                   l->plugged[i].size);
+    }
+
+    region = 0;
+    for (i = 0; i < mem_array_size && dimm < l->dimm_cnt; i++) {
+        uint64_t addr = mem_array[i].address;
+        uint64_t left = mem_array[i].length;
+
+        if (!left) {
+            continue;
+        }
+        while (left && dimm < l->dimm_cnt) {
+            uint64_t dimm_sz = smbios_dimm_size(l, dimm);
+            uint64_t chunk = MIN(left, dimm_sz - dimm_off);
+
+            assert(map < l->map_max);
+            smbios_build_type_20_table(b, map++, addr, chunk, dimm, region);
+            addr += chunk;
+            left -= chunk;
+            dimm_off += chunk;
+            if (dimm_off == dimm_sz) {
+                dimm++;
+                dimm_off = 0;
+            }
+        }
+        region++;
+    }
+    for (i = 0; i < l->plugged_cnt; i++) {
+        smbios_build_type_20_table(b, map++, l->plugged[i].addr,
+                                   l->plugged[i].size, l->dimm_cnt + i,
+                                   l->region_cnt + i);
+    }
+}
+
+static void smbios_build_type_32_table(SmbiosBuilder *b)
+{
+    SMBIOS_BUILD_TABLE_PRE(32, smbios_handle(b, 32, 0), 0, true); /* required */
+
+    memset(t->reserved, 0, 6);
+    t->boot_status = 0; /* No errors detected */
+
+    SMBIOS_BUILD_TABLE_POST;
+}
+
+static void smbios_build_type_41_table(SmbiosBuilder *b, Error **errp)
+{
+    unsigned instance = 0;
+    struct type41_instance *t41;
+
+    QTAILQ_FOREACH(t41, &b->type41, next) {
+        SMBIOS_BUILD_TABLE_PRE(41, smbios_handle(b, 41, instance), instance,
+                               true);
+
+        SMBIOS_TABLE_SET_STR(41, reference_designation_str, t41->designation);
+        t->device_type = t41->kind;
+        t->device_type_instance = t41->instance;
+        t->segment_group_number = cpu_to_le16(0);
+        t->bus_number = 0;
+        t->device_number = 0;
+
+        if (t41->pcidev) {
+            PCIDevice *pdev = smbios_find_pcidev(b, t41->pcidev);
+            if (!pdev) {
+                error_setg(errp,
+                           "No PCI device %s for SMBIOS type 41 entry %s",
+                           t41->pcidev, t41->designation);
+                return;
+            }
+            t->segment_group_number = cpu_to_le16(0);
+            if (!smbios_set_bus_number(b, t_off +
+                                       offsetof(struct smbios_type_41,
+                                                bus_number),
+                                       41, t41->pcidev, pdev, errp)) {
+                return;
+            }
+            t->device_number = pdev->devfn;
+        }
+
+        SMBIOS_BUILD_TABLE_POST;
+        instance++;
+    }
+}
+
+static void smbios_build_type_127_table(SmbiosBuilder *b)
+{
+    SMBIOS_BUILD_TABLE_PRE(127, smbios_handle(b, 127, 0), 0,
+                           true); /* required */
+    SMBIOS_BUILD_TABLE_POST;
+}
+
+void smbios_builder_set_cpuid(SmbiosBuilder *b, uint32_t version,
+                              uint32_t features)
+{
+    b->cpuid_version = version;
+    b->cpuid_features = features;
+    b->parts_dirty |= 1u << SMBIOS_PART_CPU;
+}
+
+#define SMBIOS_SET_DEFAULT(field, value)                                  \
+    if (!field) {                                                         \
+        field = value;                                                    \
+    }
+
+void smbios_builder_set_default_processor_family(SmbiosBuilder *b,
+                                                 uint16_t processor_family)
+{
+    if (b->type4.processor_family <= 0x01) {
+        b->type4.processor_family = processor_family;
+    }
+    b->parts_dirty |= 1u << SMBIOS_PART_CPU;
+}
+
+void smbios_builder_set_defaults(SmbiosBuilder *b, const char *manufacturer,
+                                 const char *product, const char *version,
+                                 bool uuid_encoded)
+{
+    b->have_defaults = true;
+    b->uuid_encoded = uuid_encoded;
+    b->parts_dirty = SMBIOS_PARTS_ALL;
+
+    SMBIOS_SET_DEFAULT(b->type1.manufacturer, "Maxsun"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type1.product, "MS-Terminator B760M"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type1.version, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type2.manufacturer, "Maxsun"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type2.product, "MS-Terminator B760M"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type2.version, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type3.manufacturer, "Default string"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type3.version, "Default string"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type4.sock_pfx, "CPU");
+    SMBIOS_SET_DEFAULT(b->type4.manufacturer, "Intel(R) Corporation"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type4.version, "12th Gen Intel(R) Core(TM) i7-12700"); //小迪SEC666 modify
+    SMBIOS_SET_DEFAULT(b->type17.loc_pfx, "DIMM");
+    SMBIOS_SET_DEFAULT(b->type17.manufacturer, "KINGSTON"); //小迪SEC666 modify
+
+}
+
+void smbios_set_cpuid(uint32_t version, uint32_t features)
+{
+    smbios_builder_set_cpuid(smbios_default_builder(), version, features);
+}
+
+void smbios_set_default_processor_family(uint16_t processor_family)
+{
+    smbios_builder_set_default_processor_family(smbios_default_builder(),
+                                                processor_family);
+}
+
+void smbios_set_defaults(const char *manufacturer, const char *product,
+                         const char *version,
+                         bool uuid_encoded)
+{
+    smbios_builder_set_defaults(smbios_default_builder(), manufacturer,
+                                product, version, uuid_encoded);
+}
+
+/* @v31: the tables have fields SMBIOS 3.1 added */
+static void smbios_entry_point_setup(SmbiosBuilder *b,
+                                     SmbiosEntryPointType ep_type, bool v31)
+{
+    switch (ep_type) {
+    case SMBIOS_ENTRY_POINT_TYPE_32:
+        memcpy(b->ep.ep21.anchor_string, "_SM_", 4);
+        memcpy(b->ep.ep21.intermediate_anchor_string, "_DMI_", 5);
+        b->ep.ep21.length = sizeof(struct smbios_21_entry_point);
+        b->ep.ep21.entry_point_revision = 0; /* formatted_area reserved */
+        memset(b->ep.ep21.formatted_area, 0, 5);
+
+        /* compliant with smbios spec v2.8 */
+        b->ep.ep21.smbios_major_version = 2;
+        b->ep.ep21.smbios_minor_version = 8;
+        b->ep.ep21.smbios_bcd_revision = 0x28;
+
+        /* set during table construction, but BIOS may override: */
+        b->ep.ep21.structure_table_length = cpu_to_le16(b->tables.len);
+        b->ep.ep21.max_structure_size = cpu_to_le16(b->tables.max);
+        b->ep.ep21.number_of_structures = cpu_to_le16(b->tables.cnt);
+
+        /* BIOS must recalculate */
+        b->ep.ep21.checksum = 0;
+        b->ep.ep21.intermediate_checksum = 0;
+        b->ep.ep21.structure_table_address = cpu_to_le32(0);
+
+        break;
+    case SMBIOS_ENTRY_POINT_TYPE_64:
+        memcpy(b->ep.ep30.anchor_string, "_SM3_", 5);
+        b->ep.ep30.length = sizeof(struct smbios_30_entry_point);
+        b->ep.ep30.entry_point_revision = 1;
+        b->ep.ep30.reserved = 0;
+
+        /* compliant with smbios spec 3.0, or 3.1 */
+        b->ep.ep30.smbios_major_version = 3;
+        b->ep.ep30.smbios_minor_version = v31 ? 1 : 0;
+        b->ep.ep30.smbios_doc_rev = 0;
+
+        /* set during table construct, but BIOS might override */
+        b->ep.ep30.structure_table_max_size = cpu_to_le32(b->tables.len);
+
+        /* BIOS must recalculate */
+        b->ep.ep30.checksum = 0;
+        b->ep.ep30.structure_table_address = cpu_to_le64(0);
+
+        break;
+    default:
+        abort();
+        break;
+    }
+}
+
+/*
+ * Generated tables cache
+ *
+ * With '-smbios cache-dir=<dir>', every finished table set is stored in
+ * <dir>/<key>.smbios, where <key> is a SHA256 over everything the build
+ * depends on. A later build with the same inputs just reads the file.
+ * Bump SMBIOS_CACHE_VERSION whenever the generated tables change for
+ * unchanged inputs.
+ */
+#define SMBIOS_CACHE_MAGIC "QSMBIOS\0"
+#define SMBIOS_CACHE_VERSION 8
+#define SMBIOS_CACHE_KEY_LEN 32 /* SHA256 */
+
+typedef struct QEMU_PACKED SmbiosCacheHeader {
+    uint8_t magic[8];
+    uint32_t version;
+    uint32_t ep_type;
+    uint32_t anchor_len;
+    uint32_t table_max;
+    uint32_t table_cnt;
+    uint64_t tables_len;
+    uint8_t key[SMBIOS_CACHE_KEY_LEN];
+    uint8_t csum[SMBIOS_CACHE_KEY_LEN]; /* SHA256 of anchor + tables */
+} SmbiosCacheHeader;
+
+static void smbios_cache_add(GChecksum *cs, const void *data, size_t len)
+{
+    g_checksum_update(cs, data, len);
+}
+
+#define smbios_cache_add_val(cs, val) smbios_cache_add(cs, &(val), sizeof(val))
+
+/* strings are length-prefixed so that NULL, "" and concatenations differ */
+static void smbios_cache_add_str(SmbiosBuilder *b, GChecksum *cs,
+                                 const char *str)
+{
+    uint64_t len = str ? smbios_builder_strlen(b, str) : UINT64_MAX;
+
+    smbios_cache_add_val(cs, len);
+    if (str) {
+        smbios_cache_add(cs, str, len);
+    }
+}
+
+static bool smbios_cache_add_pcidev(SmbiosBuilder *b, GChecksum *cs,
+                                    const char *pcidev)
+{
+    PCIDevice *pdev;
+    int bus_num, devfn;
+
+    smbios_cache_add_str(b, cs, pcidev);
+    if (!pcidev) {
+        return true;
+    }
+    /*
+     * Lookup errors are left for the table builders to report. The bus
+     * behind a bridge is patched in after the build, which the cached
+     * tables would miss.
+     */
+    pdev = smbios_find_pcidev(b, pcidev);
+    if (!pdev || !pci_bus_is_root(pci_get_bus(pdev))) {
+        return false;
+    }
+    bus_num = pci_dev_bus_num(pdev);
+    devfn = pdev->devfn;
+    smbios_cache_add_val(cs, bus_num);
+    smbios_cache_add_val(cs, devfn);
+    return true;
+}
+
+static int smbios_find_ipmi(Object *obj, void *opaque)
+{
+    return object_dynamic_cast(obj, TYPE_IPMI_INTERFACE) != NULL;
+}
+
+/*
+ * Compute the cache key of the table set about to be built into @key.
+ * Returns false if the tables depend on state the key can't capture.
+ */
+static bool smbios_cache_key(SmbiosBuilder *b, MachineState *ms,
+                             SmbiosEntryPointType ep_type,
+                             const struct smbios_phys_mem_area *mem_array,
+                             const unsigned int mem_array_size,
+                             uint8_t *key)
+{
+    g_autoptr(GChecksum) cs = g_checksum_new(G_CHECKSUM_SHA256);
+    struct type8_instance *t8;
+    struct type9_instance *t9;
+    struct type41_instance *t41;
+    uint32_t val;
+    gsize key_len = SMBIOS_CACHE_KEY_LEN;
+    size_t i;
+
+    /* type 38 is built from the IPMI devices, which we don't track here */
+    if (b->machine && object_child_foreach_recursive(object_get_root(),
+                                       smbios_find_ipmi, NULL)) {
+        return false;
+    }
+
+    smbios_cache_add_str(b, cs, QEMU_VERSION);
+    val = SMBIOS_CACHE_VERSION;
+    smbios_cache_add_val(cs, val);
+    smbios_cache_add_val(cs, ep_type);
+
+    /* machine */
+    val = ms->smp.sockets;
+    smbios_cache_add_val(cs, val);
+    val = machine_topo_get_cores_per_socket(ms);
+    smbios_cache_add_val(cs, val);
+    val = machine_topo_get_threads_per_socket(ms);
+    smbios_cache_add_val(cs, val);
+    smbios_cache_add(cs, b->socket_cores,
+                     ms->smp.sockets * sizeof(*b->socket_cores));
+    smbios_cache_add_val(cs, ms->ram_size);
+    for (i = 0; i < mem_array_size; i++) {
+        smbios_cache_add_val(cs, mem_array[i].address);
+        smbios_cache_add_val(cs, mem_array[i].length);
+    }
+    for (i = 0; i < b->dimms->len; i++) {
+        smbios_cache_add_val(cs, g_array_index(b->dimms, SmbiosDimm, i).addr);
+        smbios_cache_add_val(cs, g_array_index(b->dimms, SmbiosDimm, i).size);
+    }
+    smbios_cache_add_val(cs, b->cpuid_version);
+    smbios_cache_add_val(cs, b->cpuid_features);
+    smbios_cache_add_val(cs, b->uuid_set);
+    smbios_cache_add_val(cs, b->uuid);
+    smbios_cache_add_val(cs, b->uuid_encoded);
+    smbios_cache_add_val(cs, b->have_defaults);
+
+    /* user blobs and -smbios fields */
+    smbios_cache_add_val(cs, b->usr_blobs_len);
+    if (b->usr_blobs_len) {
+        smbios_cache_add(cs, b->usr_blobs, b->usr_blobs_len);
+    }
+    smbios_cache_add(cs, b->have_binfile_bitmap,
+                     sizeof(b->have_binfile_bitmap));
+    smbios_cache_add(cs, b->have_fields_bitmap,
+                     sizeof(b->have_fields_bitmap));
+
+    smbios_cache_add_str(b, cs, b->type0.vendor);
+    smbios_cache_add_str(b, cs, b->type0.version);
+    smbios_cache_add_str(b, cs, b->type0.date);
+    smbios_cache_add_val(cs, b->type0.have_major_minor);
+    smbios_cache_add_val(cs, b->type0.uefi);
+    smbios_cache_add_val(cs, b->type0.major);
+    smbios_cache_add_val(cs, b->type0.minor);
+
+    smbios_cache_add_str(b, cs, b->type1.manufacturer);
+    smbios_cache_add_str(b, cs, b->type1.product);
+    smbios_cache_add_str(b, cs, b->type1.version);
+    smbios_cache_add_str(b, cs, b->type1.serial);
+    smbios_cache_add_str(b, cs, b->type1.sku);
+    smbios_cache_add_str(b, cs, b->type1.family);
+
+    smbios_cache_add_str(b, cs, b->type2.manufacturer);
+    smbios_cache_add_str(b, cs, b->type2.product);
+    smbios_cache_add_str(b, cs, b->type2.version);
+    smbios_cache_add_str(b, cs, b->type2.serial);
+    smbios_cache_add_str(b, cs, b->type2.asset);
+    smbios_cache_add_str(b, cs, b->type2.location);
+
+    smbios_cache_add_str(b, cs, b->type3.manufacturer);
+    smbios_cache_add_str(b, cs, b->type3.version);
+    smbios_cache_add_str(b, cs, b->type3.serial);
+    smbios_cache_add_str(b, cs, b->type3.asset);
+    smbios_cache_add_str(b, cs, b->type3.sku);
+
+    smbios_cache_add_val(cs, b->type4.processor_family);
+    smbios_cache_add_str(b, cs, b->type4.sock_pfx);
+    smbios_cache_add_str(b, cs, b->type4.manufacturer);
+    smbios_cache_add_str(b, cs, b->type4.version);
+    smbios_cache_add_str(b, cs, b->type4.serial);
+    smbios_cache_add_str(b, cs, b->type4.asset);
+    smbios_cache_add_str(b, cs, b->type4.part);
+    smbios_cache_add_val(cs, b->type4.max_speed);
+    smbios_cache_add_val(cs, b->type4.current_speed);
+    smbios_cache_add_val(cs, b->type4.processor_id);
+
+    QTAILQ_FOREACH(t8, &b->type8, next) {
+        smbios_cache_add_str(b, cs, t8->internal_reference);
+        smbios_cache_add_str(b, cs, t8->external_reference);
+        smbios_cache_add_val(cs, t8->connector_type);
+        smbios_cache_add_val(cs, t8->port_type);
+    }
+
+    QTAILQ_FOREACH(t9, &b->type9, next) {
+        smbios_cache_add_str(b, cs, t9->slot_designation);
+        smbios_cache_add_val(cs, t9->slot_type);
+        smbios_cache_add_val(cs, t9->slot_data_bus_width);
+        smbios_cache_add_val(cs, t9->current_usage);
+        smbios_cache_add_val(cs, t9->slot_length);
+        smbios_cache_add_val(cs, t9->slot_characteristics1);
+        smbios_cache_add_val(cs, t9->slot_characteristics2);
+        smbios_cache_add_val(cs, t9->slot_id);
+        if (!smbios_cache_add_pcidev(b, cs, t9->pcidev)) {
+            return false;
+        }
+    }
+
+    smbios_cache_add_val(cs, b->type11.nvalues);
+    for (i = 0; i < b->type11.nvalues; i++) {
+        smbios_cache_add_str(b, cs, b->type11.values[i]);
+    }
+
+    smbios_cache_add_str(b, cs, b->type17.loc_pfx);
+    smbios_cache_add_str(b, cs, b->type17.bank);
+    smbios_cache_add_str(b, cs, b->type17.manufacturer);
+    smbios_cache_add_str(b, cs, b->type17.serial);
+    smbios_cache_add_str(b, cs, b->type17.asset);
+    smbios_cache_add_str(b, cs, b->type17.part);
+    smbios_cache_add_val(cs, b->type17.speed);
+    smbios_cache_add_val(cs, b->type17.dimm_size);
+
+    QTAILQ_FOREACH(t41, &b->type41, next) {
+        smbios_cache_add_str(b, cs, t41->designation);
+        smbios_cache_add_val(cs, t41->instance);
+        smbios_cache_add_val(cs, t41->kind);
+        if (!smbios_cache_add_pcidev(b, cs, t41->pcidev)) {
+            return false;
+        }
+    }
+
+    g_checksum_get_digest(cs, key, &key_len);
+    assert(key_len == SMBIOS_CACHE_KEY_LEN);
+    return true;
+}
+
+static char *smbios_cache_path(SmbiosBuilder *b, const uint8_t *key)
+{
+    char name[SMBIOS_CACHE_KEY_LEN * 2 + sizeof(".smbios")];
+    size_t i;
+
+    for (i = 0; i < SMBIOS_CACHE_KEY_LEN; i++) {
+        snprintf(name + 2 * i, 3, "%02x", key[i]);
+    }
+    strcpy(name + 2 * i, ".smbios");
+    return g_build_filename(b->cache_dir, name, NULL);
+}
+
+static void smbios_cache_csum(const uint8_t *data, size_t len, uint8_t *csum)
+{
+    g_autoptr(GChecksum) cs = g_checksum_new(G_CHECKSUM_SHA256);
+    gsize csum_len = SMBIOS_CACHE_KEY_LEN;
+
+    g_checksum_update(cs, data, len);
+    g_checksum_get_digest(cs, csum, &csum_len);
+}
+
+/*
+ * Load the table set cached under @key into @b's tables and entry point.
+ * Anything unexpected in the file counts as a miss.
+ */
+static bool smbios_cache_load(SmbiosBuilder *b, const uint8_t *key)
+{
+    g_autofree char *path = smbios_cache_path(b, key);
+    g_autofree char *buf = NULL;
+    SmbiosCacheHeader hdr;
+    uint8_t csum[SMBIOS_CACHE_KEY_LEN];
+    size_t payload_len;
+    gsize len;
+
+    if (!g_file_get_contents(path, &buf, &len, NULL)) {
+        return false;
+    }
+    if (len < sizeof(hdr)) {
+        return false;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    payload_len = len - sizeof(hdr);
+    if (memcmp(hdr.magic, SMBIOS_CACHE_MAGIC, sizeof(hdr.magic)) ||
+        le32_to_cpu(hdr.version) != SMBIOS_CACHE_VERSION ||
+        memcmp(hdr.key, key, SMBIOS_CACHE_KEY_LEN) ||
+        le32_to_cpu(hdr.anchor_len) > sizeof(b->ep) ||
+        le32_to_cpu(hdr.anchor_len) > payload_len ||
+        le64_to_cpu(hdr.tables_len) !=
+            payload_len - le32_to_cpu(hdr.anchor_len)) {
+        return false;
+    }
+    smbios_cache_csum((uint8_t *)buf + sizeof(hdr), payload_len, csum);
+    if (memcmp(hdr.csum, csum, sizeof(csum))) {
+        return false;
+    }
+
+    memset(&b->ep, 0, sizeof(b->ep));
+    memcpy(&b->ep, buf + sizeof(hdr), le32_to_cpu(hdr.anchor_len));
+    b->tables.max = le32_to_cpu(hdr.table_max);
+    b->tables.cnt = le32_to_cpu(hdr.table_cnt);
+    b->stats.ep_type = le32_to_cpu(hdr.ep_type);
+
+    /* reuse the file buffer for the tables themselves */
+    b->tables.len = le64_to_cpu(hdr.tables_len);
+    memmove(buf, buf + sizeof(hdr) + le32_to_cpu(hdr.anchor_len),
+            b->tables.len);
+    smbios_tables_free(b);
+    b->tables.data = (uint8_t *)g_steal_pointer(&buf);
+    b->tables.size = len;
+    b->stats.allocs++;
+    b->stats.peak_size = len;
+    return true;
+}
+
+/* Store the table set just built under @key, failures only cost speed */
+static void smbios_cache_save(SmbiosBuilder *b, const uint8_t *key,
+                              SmbiosEntryPointType ep_type, size_t anchor_len)
+{
+    g_autofree char *path = smbios_cache_path(b, key);
+    g_autofree uint8_t *buf = NULL;
+    SmbiosCacheHeader *hdr;
+    size_t len = sizeof(*hdr) + anchor_len + b->tables.len;
+    GError *err = NULL;
+
+    buf = g_malloc0(len);
+    hdr = (SmbiosCacheHeader *)buf;
+    memcpy(hdr->magic, SMBIOS_CACHE_MAGIC, sizeof(hdr->magic));
+    hdr->version = cpu_to_le32(SMBIOS_CACHE_VERSION);
+    hdr->ep_type = cpu_to_le32(ep_type);
+    hdr->anchor_len = cpu_to_le32(anchor_len);
+    hdr->table_max = cpu_to_le32(b->tables.max);
+    hdr->table_cnt = cpu_to_le32(b->tables.cnt);
+    hdr->tables_len = cpu_to_le64(b->tables.len);
+    memcpy(hdr->key, key, SMBIOS_CACHE_KEY_LEN);
+    memcpy(buf + sizeof(*hdr), &b->ep, anchor_len);
+    memcpy(buf + sizeof(*hdr) + anchor_len, b->tables.data, b->tables.len);
+    smbios_cache_csum(buf + sizeof(*hdr), anchor_len + b->tables.len,
+                      hdr->csum);
+
+    /* g_file_set_contents() replaces the file atomically */
+    if (!g_file_set_contents(path, (char *)buf, len, &err)) {
+        warn_report("Cannot write SMBIOS cache file %s: %s",
+                    path, err->message);
+        g_error_free(err);
+    }
+}
+
+/*
+ * Host-wide shared tables
+ *
+ * Guests configured alike get byte-identical tables. With
+ * '-smbios share-dir=<dir>', <dir> being a tmpfs such as /dev/shm, the
+ * finished tables are published as <dir>/qemu-smbios-<sha256>. Every
+ * process that builds the same bytes maps that file read-only and lets
+ * fw_cfg serve from the mapping, so a host keeps one copy per distinct
+ * table set instead of one per VM. A file is written in full before it
+ * is linked into <dir>, and its contents are compared with the tables
+ * just built before they are dropped. Tables whose bus numbers are
+ * patched at run time stay private.
+ *
+ * Only byte-identical tables are shared. Type 1 holds the VM's UUID, so
+ * VMs given one of their own, as Proxmox VE does with
+ * '-smbios type=1,uuid=', never share their tables with another VM.
+ * Sharing pays off for VMs started without a UUID of their own, such as
+ * throwaway test guests.
+ *
+ * Each process holds a shared flock() on the file it maps. Whoever finds
+ * a file unlocked may unlink it: a process leaving unlinks its file if
+ * it was the last user, and files of processes that died are swept
+ * before publishing. The mappings stay valid after the unlink.
+ */
+#ifdef CONFIG_LINUX
+/*
+ * Lock the shared tables @fd against removal and check they weren't
+ * unlinked from @path since they were opened
+ */
+static bool smbios_share_lock(int fd, const char *path)
+{
+    struct stat st, path_st;
+
+    return flock(fd, LOCK_SH) == 0 &&
+           fstat(fd, &st) == 0 && stat(path, &path_st) == 0 &&
+           st.st_dev == path_st.st_dev && st.st_ino == path_st.st_ino;
+}
+
+/* Unlink the tables in <dir> nobody maps any more */
+static void smbios_share_sweep(SmbiosBuilder *b)
+{
+    g_autoptr(GDir) dir = g_dir_open(b->share_dir, 0, NULL);
+    const char *name;
+
+    while (dir && (name = g_dir_read_name(dir))) {
+        g_autofree char *path = NULL;
+        int fd;
+
+        if (!g_str_has_prefix(name, "qemu-smbios-")) {
+            continue;
+        }
+        path = g_build_filename(b->share_dir, name, NULL);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            smbios_share_unlink_unused(fd, path);
+            close(fd);
+        }
+    }
+}
+
+/*
+ * Create @path holding @b's tables, already locked, or open it if
+ * someone was faster
+ */
+static int smbios_share_publish(SmbiosBuilder *b, const char *path)
+{
+    g_autofree char *proc = NULL;
+    int fd, err;
+
+    fd = open(b->share_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0444);
+    if (fd < 0) {
+        return -1;
+    }
+    if (flock(fd, LOCK_SH) < 0 ||
+        qemu_write_full(fd, b->tables.data, b->tables.len) !=
+        b->tables.len) {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+    proc = g_strdup_printf("/proc/self/fd/%d", fd);
+    if (linkat(AT_FDCWD, proc, AT_FDCWD, path, AT_SYMLINK_FOLLOW) < 0) {
+        err = errno;
+        close(fd);
+        if (err == EEXIST) {
+            return open(path, O_RDONLY | O_CLOEXEC);
+        }
+        errno = err;
+        return -1;
+    }
+    return fd;
+}
+#endif
+
+/* Swap @b's tables for the host-wide copy, failures only cost memory */
+static void smbios_share_tables(SmbiosBuilder *b)
+{
+#ifdef CONFIG_LINUX
+    char name[sizeof("qemu-smbios-") + SMBIOS_CACHE_KEY_LEN * 2];
+    uint8_t key[SMBIOS_CACHE_KEY_LEN];
+    g_autofree char *path = NULL;
+    struct stat st;
+    unsigned tries;
+    void *map;
+    size_t i;
+    int fd;
+
+    if (!b->tables.len || (b->bus_fixups && b->bus_fixups->len)) {
+        return;
+    }
+    smbios_share_sweep(b);
+
+    smbios_cache_csum(b->tables.data, b->tables.len, key);
+    strcpy(name, "qemu-smbios-");
+    for (i = 0; i < SMBIOS_CACHE_KEY_LEN; i++) {
+        snprintf(name + strlen("qemu-smbios-") + 2 * i, 3, "%02x", key[i]);
+    }
+    path = g_build_filename(b->share_dir, name, NULL);
+
+    /* the file may be unlinked by its last user until we hold the lock */
+    for (tries = 0; ; tries++) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0 && errno == ENOENT) {
+            fd = smbios_share_publish(b, path);
+        }
+        if (fd < 0) {
+            warn_report("Cannot share SMBIOS tables as %s: %s",
+                        path, strerror(errno));
+            return;
+        }
+        if (smbios_share_lock(fd, path)) {
+            break;
+        }
+        close(fd);
+        if (tries == 3) {
+            return;
+        }
+    }
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != b->tables.len) {
+        close(fd);
+        return;
+    }
+    map = mmap(NULL, b->tables.len, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return;
+    }
+    if (memcmp(map, b->tables.data, b->tables.len)) {
+        munmap(map, b->tables.len);
+        close(fd);
+        return;
+    }
+
+    smbios_tables_free(b);
+    /* of the private copy, only the file= blobs are still needed */
+    if (b->usr_blobs_size > b->usr_blobs_len) {
+        b->usr_blobs = g_realloc(b->usr_blobs, b->usr_blobs_len);
+        b->usr_blobs_size = b->usr_blobs_len;
+    }
+    b->tables.data = map;
+    b->tables.size = b->tables.len;
+    b->tables_shared = true;
+    b->share_fd = fd;
+    b->share_path = g_steal_pointer(&path);
+    b->stats.shared = true;
+    /* QEMU doesn't free the machine's builder, drop the file on exit */
+    if (b->machine && !b->share_exit.notify) {
+        b->share_exit.notify = smbios_share_exit;
+        qemu_add_exit_notifier(&b->share_exit);
+    }
+#endif
+}
+
+/*
+ * Generous estimate of the generated structures, so that the blob is
+ * normally built in one allocation. smbios_tables_reserve() still grows
+ * it should the estimate fall short.
+ */
+#define SMBIOS_FIXED_TABLES_SZ (4 * KiB) /* types 0-3, 7, 16, 22-39, 127 */
+#define SMBIOS_TABLE_SZ_HINT 192 /* per repeated structure, strings included */
+
+static size_t smbios_tables_size_hint(SmbiosBuilder *b, MachineState *ms,
+                                      const SmbiosMemLayout *mem)
+{
+    struct type8_instance *t8;
+    struct type9_instance *t9;
+    struct type41_instance *t41;
+    size_t cnt = ms->smp.sockets + mem->dimm_cnt + mem->region_cnt +
+                 mem->map_max + 3 * mem->plugged_cnt;
+    size_t hint = SMBIOS_FIXED_TABLES_SZ;
+    size_t i;
+
+    QTAILQ_FOREACH(t8, &b->type8, next) {
+        cnt++;
+    }
+    QTAILQ_FOREACH(t9, &b->type9, next) {
+        cnt++;
+    }
+    QTAILQ_FOREACH(t41, &b->type41, next) {
+        cnt++;
+    }
+    for (i = 0; i < b->type11.nvalues; i++) {
+        hint += b->type11.values[i] ?
+                smbios_builder_strlen(b, b->type11.values[i]) + 1 : 0;
+    }
+    /* the fixed size has socket 0's caches */
+    for (i = 0; i < SMBIOS_T7_PER_SOCKET; i++) {
+        hint += (ms->smp.sockets - 1) * smbios_type_7_images[i].len;
+    }
+    cnt += b->type11.nvalues / SMBIOS_T11_MAX_STRINGS;
+
+    return hint + cnt * SMBIOS_TABLE_SZ_HINT;
+}
+
+#define SMBIOS_TYPE_4_V30_EXTRA (SMBIOS_TYPE_4_LEN_V30 - SMBIOS_TYPE_4_LEN_V28)
+#define SMBIOS_TYPE_7_V31_EXTRA (SMBIOS_TYPE_7_LEN_V31 - SMBIOS_TYPE_7_LEN_V21)
+
+/* Can the type 4 tables be expressed in the SMBIOS 2.8 layout at all? */
+static bool smbios_type_4_fits_v28(MachineState *ms)
+{
+    return machine_topo_get_cores_per_socket(ms) < 0xFF &&
+           machine_topo_get_threads_per_socket(ms) < 0xFF;
+}
+
+#define smbios_env_add_val(env, val) \
+    g_byte_array_append(env, (const guint8 *)&(val), sizeof(val))
+
+/*
+ * Describe the machine state @part depends on into @env. Returns false
+ * if the part must be rebuilt regardless.
+ */
+static bool smbios_part_env(SmbiosBuilder *b, SmbiosPart part, MachineState *ms,
+                            SmbiosEntryPointType ep_type,
+                            const struct smbios_phys_mem_area *mem_array,
+                            const unsigned int mem_array_size,
+                            GByteArray *env)
+{
+    struct type9_instance *t9;
+    struct type41_instance *t41;
+    uint32_t val;
+    unsigned i;
+
+    g_byte_array_set_size(env, 0);
+    switch (part) {
+    case SMBIOS_PART_CPU:
+        smbios_env_add_val(env, ep_type);
+        val = machine_topo_get_threads_per_socket(ms);
+        smbios_env_add_val(env, val);
+        g_byte_array_append(env, (const guint8 *)b->socket_cores,
+                            ms->smp.sockets * sizeof(*b->socket_cores));
+        /* fall through */
+    case SMBIOS_PART_CACHE:
+        /* AUTO builds the 3.1 layout too, see smbios_get_tables_ep() */
+        val = ep_type == SMBIOS_ENTRY_POINT_TYPE_32;
+        smbios_env_add_val(env, val);
+        val = ms->smp.sockets;
+        smbios_env_add_val(env, val);
+        val = machine_topo_get_cores_per_socket(ms);
+        smbios_env_add_val(env, val);
+        break;
+    case SMBIOS_PART_SLOTS:
+        QTAILQ_FOREACH(t9, &b->type9, next) {
+            if (t9->pcidev) {
+                return false;
+            }
+        }
+        break;
+    case SMBIOS_PART_MEM:
+        smbios_env_add_val(env, ms->ram_size);
+        for (i = 0; i < mem_array_size; i++) {
+            smbios_env_add_val(env, mem_array[i].address);
+            smbios_env_add_val(env, mem_array[i].length);
+        }
+        for (i = 0; i < b->dimms->len; i++) {
+            smbios_env_add_val(env,
+                               g_array_index(b->dimms, SmbiosDimm, i).addr);
+            smbios_env_add_val(env,
+                               g_array_index(b->dimms, SmbiosDimm, i).size);
+        }
+        break;
+    case SMBIOS_PART_FIXED:
+        if (b->machine && object_child_foreach_recursive(object_get_root(),
+                                           smbios_find_ipmi, NULL)) {
+            return false;
+        }
+        break;
+    case SMBIOS_PART_ONBOARD:
+        QTAILQ_FOREACH(t41, &b->type41, next) {
+            if (t41->pcidev) {
+                return false;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+/*
+ * Reuse the structures @part built last time if nothing they depend on
+ * changed. Otherwise returns true, the caller builds them and calls
+ * smbios_part_end().
+ */
+static bool smbios_part_begin(SmbiosBuilder *b, SmbiosPart part,
+                              MachineState *ms, SmbiosEntryPointType ep_type,
+                              const struct smbios_phys_mem_area *mem_array,
+                              const unsigned int mem_array_size)
+{
+    SmbiosPartState *p = &b->parts[part];
+    int64_t start = g_get_monotonic_time();
+    unsigned allocs = b->stats.allocs;
+    g_autoptr(GByteArray) env = g_byte_array_new();
+    bool tracked = smbios_part_env(b, part, ms, ep_type, mem_array,
+                                   mem_array_size, env);
+
+    if (!p->data) {
+        p->env = g_byte_array_new();
+        p->data = g_byte_array_new();
+        p->handles = g_array_new(false, false, sizeof(SmbiosPartHandle));
+    }
+
+    if (tracked && p->valid && !(b->parts_dirty & (1u << part)) &&
+        env->len == p->env->len && !memcmp(env->data, p->env->data, env->len) &&
+        smbios_handles_replay(b, p)) {
+        memcpy(smbios_tables_reserve(p->data->len), p->data->data,
+               p->data->len);
+        b->tables.len += p->data->len;
+        b->tables.max = MAX(b->tables.max, p->table_max);
+        b->tables.cnt += p->table_cnt;
+        b->type4_count += p->type4_cnt;
+        b->stats.reused += p->table_cnt;
+        trace_smbios_part_reuse(smbios_part_info[part].name, p->table_cnt,
+                                p->data->len);
+        p->built = p->reused = true;
+        p->build_us = g_get_monotonic_time() - start;
+        p->allocs = b->stats.allocs - allocs;
+        return false;
+    }
+
+    p->valid = false;
+    p->tracked = tracked;
+    g_byte_array_set_size(p->env, 0);
+    if (tracked) {
+        g_byte_array_append(p->env, env->data, env->len);
+    }
+    g_array_set_size(p->handles, 0);
+    p->start = b->tables.len;
+    p->prev_max = b->tables.max;
+    p->table_cnt = b->tables.cnt;
+    p->type4_cnt = b->type4_count;
+    p->built = true;
+    p->reused = false;
+    p->build_us = start;
+    p->allocs = allocs;
+    b->tables.max = 0;
+    b->part_cur = p;
+    b->parts_dirty &= ~(1u << part);
+    return true;
+}
+
+static void smbios_part_end(SmbiosBuilder *b)
+{
+    SmbiosPartState *p = b->part_cur;
+
+    p->table_max = b->tables.max;
+    p->table_cnt = b->tables.cnt - p->table_cnt;
+    p->type4_cnt = b->type4_count - p->type4_cnt;
+    b->tables.max = MAX(p->prev_max, p->table_max);
+    p->build_us = g_get_monotonic_time() - p->build_us;
+    p->allocs = b->stats.allocs - p->allocs;
+
+    g_byte_array_set_size(p->data, 0);
+    p->valid = p->tracked;
+    if (p->valid) {
+        g_byte_array_append(p->data, b->tables.data + p->start,
+                            b->tables.len - p->start);
+    }
+    b->part_cur = NULL;
+}
+
+/* Length of the entry point @ep, based on its anchor string */
+static size_t smbios_anchor_len(const SmbiosEntryPoint *ep)
+{
+    if (!strncmp((const char *)ep, "_SM_", 4)) {
+        return sizeof(struct smbios_21_entry_point);
+    } else if (!strncmp((const char *)ep, "_SM3_", 5)) {
+        return sizeof(struct smbios_30_entry_point);
+    }
+    return 0;
+}
+
+static bool smbios_get_tables_ep(SmbiosBuilder *b, MachineState *ms,
+                       SmbiosEntryPointType ep_type,
+                       const struct smbios_phys_mem_area *mem_array,
+                       const unsigned int mem_array_size,
+                       uint8_t **tables, size_t *tables_len,
+                       uint8_t **anchor, size_t *anchor_len,
+                       Error **errp)
+{
+    unsigned t4_max, t7_max, t7_cnt, other_max;
+    SmbiosMemLayout mem;
+    size_t t4_start, t7_start, size;
+    uint8_t cache_key[SMBIOS_CACHE_KEY_LEN];
+    bool cacheable = false, cache_hit = false;
+    bool ep_auto = ep_type == SMBIOS_ENTRY_POINT_TYPE_AUTO;
+    SmbiosPart part;
+    ERRP_GUARD();
+
+    assert(ep_type == SMBIOS_ENTRY_POINT_TYPE_32 ||
+           ep_type == SMBIOS_ENTRY_POINT_TYPE_64 ||
+           ep_type == SMBIOS_ENTRY_POINT_TYPE_AUTO);
+
+    memset(&b->stats, 0, sizeof(b->stats));
+    smbios_type_stats_reset(b);
+    for (part = 0; part < SMBIOS_PART__MAX; part++) {
+        b->parts[part].built = false;
+    }
+    b->stats.build_us = g_get_monotonic_time();
+    trace_smbios_build_begin(ep_type, ms->smp.sockets, ms->ram_size);
+    smbios_bus_fixups_reset(b);
+    smbios_str_lens_reset(b);
+    smbios_socket_cores_update(b, ms);
+
+    if (b->cache_dir) {
+        cacheable = smbios_cache_key(b, ms, ep_type, mem_array, mem_array_size,
+                                     cache_key);
+        if (cacheable && smbios_cache_load(b, cache_key)) {
+            cache_hit = true;
+            goto out;
+        }
+    }
+
+    smbios_tables_free(b);
+    b->type4_count = 0;
+
+    smbios_handles_reset(b);
+    smbios_mem_layout(b, &mem, ms->ram_size, mem_array, mem_array_size);
+
+    /*
+     * The file= blobs come first in the tables, so build right behind
+     * them in their own buffer rather than copying them out. Size it up
+     * front, the builders then write in place.
+     */
+    size = b->usr_blobs_len + smbios_tables_size_hint(b, ms, &mem);
+    if (size > b->usr_blobs_size) {
+        b->usr_blobs = g_realloc(b->usr_blobs, size);
+        b->usr_blobs_size = size;
+        b->stats.allocs++;
+    }
+    b->tables.data = b->usr_blobs;
+    b->tables.size = b->usr_blobs_size;
+    b->stats.peak_size = b->tables.size;
+    b->tables.len = b->usr_blobs_len;
+    b->tables.max = b->usr_table_max;
+    b->tables.cnt = b->usr_table_cnt;
+
+#define SMBIOS_PART_BEGIN(part) \
+    smbios_part_begin(b, part, ms, ep_type, mem_array, mem_array_size)
+
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_SYSTEM)) {
+        smbios_build_type_0_table(b);
+        smbios_build_type_1_table(b);
+        smbios_build_type_2_table(b);
+        smbios_build_type_3_table(b);
+        smbios_part_end(b);
+    }
+
+    assert(ms->smp.sockets >= 1);
+
+    /*
+     * Keep the type 4 tables out of tables.max for now, AUTO may
+     * still shrink them below.
+     */
+    other_max = b->tables.max;
+    t4_start = b->tables.len;
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_CPU)) {
+        smbios_build_type_4_tables(b, ms, ep_type, errp);
+        if (*errp) {
+            goto err_exit;
+        }
+        smbios_part_end(b);
+    }
+    t4_max = b->tables.max;
+    b->tables.max = other_max;
+    /* the same goes for the type 7 tables */
+    t7_start = b->tables.len;
+    t7_cnt = b->tables.cnt;
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_CACHE)) {
+        smbios_build_type_7_tables(b, ms, ep_type);
+        smbios_part_end(b);
+    }
+    t7_cnt = b->tables.cnt - t7_cnt;
+    t7_max = b->parts[SMBIOS_PART_CACHE].table_max;
+    b->tables.max = other_max;
+
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_SLOTS)) {
+        smbios_build_type_8_table(b);
+        smbios_build_type_9_table(b, errp);
+        if (*errp) {
+            goto err_exit;
+        }
+        smbios_part_end(b);
+    }
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_OEM)) {
+        smbios_build_type_11_table(b);
+        smbios_part_end(b);
+    }
+
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_MEM)) {
+        smbios_build_mem_tables(b, &mem, mem_array, mem_array_size);
+        smbios_part_end(b);
+    }
+
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_FIXED)) {
+        smbios_build_image_tables(b, ms, smbios_type_22_images,
+                                  ARRAY_SIZE(smbios_type_22_images));
+        smbios_build_image_tables(b, ms, smbios_sensor_images,
+                                  ARRAY_SIZE(smbios_sensor_images));
+        smbios_build_type_32_table(b);
+        smbios_build_image_tables(b, ms, smbios_type_37_images,
+                                  ARRAY_SIZE(smbios_type_37_images));
+        if (b->machine) {
+            smbios_build_type_38_table();
+        }
+        smbios_build_image_tables(b, ms, smbios_type_39_images,
+                                  ARRAY_SIZE(smbios_type_39_images));
+        smbios_part_end(b);
+    }
+    if (SMBIOS_PART_BEGIN(SMBIOS_PART_ONBOARD)) {
+        smbios_build_type_41_table(b, errp);
+        if (*errp) {
+            goto err_exit;
+        }
+        smbios_part_end(b);
+    }
+#undef SMBIOS_PART_BEGIN
+    smbios_build_type_127_table(b);
+
+    if (b->handle_err) {
+        error_propagate(errp, g_steal_pointer(&b->handle_err));
+        goto err_exit;
+    }
+
+    if (!smbios_check_type4_count(b, ms->smp.sockets, errp)) {
+        goto err_exit;
+    }
+
+    /*
+     * Pick the entry point for AUTO now that the size is known: 2.1 if
+     * the 2.8 layout of the tables fits its 16-bit length field, 3.x
+     * otherwise. Either way the tables are only built once.
+     */
+    if (ep_type == SMBIOS_ENTRY_POINT_TYPE_AUTO) {
+        unsigned t4_cnt = b->type4_count;
+        size_t len_v28 = b->tables.len - t4_cnt * SMBIOS_TYPE_4_V30_EXTRA -
+                         t7_cnt * SMBIOS_TYPE_7_V31_EXTRA;
+
+        ep_type = SMBIOS_ENTRY_POINT_TYPE_64;
+        if ((!t4_cnt || smbios_type_4_fits_v28(ms)) &&
+            len_v28 <= SMBIOS_21_MAX_TABLES_LEN) {
+            /* the type 7 tables first, shrinking type 4 moves them */
+            smbios_shrink_tables(b, t7_start, t7_cnt,
+                                 SMBIOS_TYPE_7_LEN_V31, SMBIOS_TYPE_7_LEN_V21);
+            if (t7_cnt) {
+                t7_max -= SMBIOS_TYPE_7_V31_EXTRA;
+            }
+            smbios_shrink_tables(b, t4_start, t4_cnt,
+                                 SMBIOS_TYPE_4_LEN_V30, SMBIOS_TYPE_4_LEN_V28);
+            if (t4_cnt) {
+                t4_max -= SMBIOS_TYPE_4_V30_EXTRA;
+            }
+            ep_type = SMBIOS_ENTRY_POINT_TYPE_32;
+        }
+    }
+    b->tables.max = MAX(b->tables.max, MAX(t4_max, t7_max));
+    b->stats.ep_type = ep_type;
+
+    if (!smbios_builder_validate_table(b, ep_type, errp)) {
+        goto err_exit;
+    }
+    trace_smbios_entry_point_setup_begin(ep_type, b->tables.len);
+    /* only the 64-bit entry point gets type 7 tables with 3.1 fields */
+    smbios_entry_point_setup(b, ep_type, t7_cnt != 0);
+    trace_smbios_entry_point_setup_end(ep_type, smbios_anchor_len(&b->ep));
+
+out:
+    /* the build only, publishing and caching the result are not part of it */
+    b->stats.build_us = g_get_monotonic_time() - b->stats.build_us;
+    if (b->share_dir) {
+        smbios_share_tables(b);
+    }
+
+    /* return tables blob and entry point (anchor), and their sizes */
+    *tables = b->tables.data;
+    *tables_len = b->tables.len;
+    *anchor = (uint8_t *)&b->ep;
+    *anchor_len = smbios_anchor_len(&b->ep);
+    if (!*anchor_len) {
+        abort();
+    }
+
+    if (cacheable && !cache_hit) {
+        smbios_cache_save(b, cache_key, ep_type, *anchor_len);
+    }
+
+    b->stats.tables_len = b->tables.len;
+    b->stats.structures = b->tables.cnt;
+    b->stats.cache_hit = cache_hit;
+    b->stats.auto_fallback = ep_auto &&
+                             b->stats.ep_type == SMBIOS_ENTRY_POINT_TYPE_64;
+    trace_smbios_build_end(b->stats.ep_type, b->tables.len, b->tables.cnt,
+                           cache_hit, b->stats.build_us);
+    return true;
+err_exit:
+    /* what the parts kept may be half built, or use the 0xFFFF handle */
+    for (part = 0; part < SMBIOS_PART__MAX; part++) {
+        b->parts[part].valid = false;
+    }
+    b->part_cur = NULL;
+    smbios_tables_free(b);
+    b->tables.size = 0;
+    return false;
+}
+
+void smbios_builder_get_build_stats(SmbiosBuilder *b,
+                                    SmbiosBuildStats *stats)
+{
+    *stats = b->stats;
+}
+
+void smbios_get_build_stats(SmbiosBuildStats *stats)
+{
+    smbios_builder_get_build_stats(smbios_default_builder(), stats);
+}
+
+/* Number of strings in the string-set of the @size bytes structure at @p */
+static unsigned smbios_structure_strings(const uint8_t *p, size_t size)
+{
+    const struct smbios_structure_header *header =
+        (const struct smbios_structure_header *)p;
+    unsigned n = 0;
+    size_t i;
+
+    if (size == header->length + 2) {
+        return 0;       /* just the double terminator */
+    }
+    for (i = header->length; i < size - 1; i++) {
+        n += !p[i];
+    }
+    return n;
+}
+
+SmbiosInfo *qmp_query_smbios(Error **errp)
+{
+    SmbiosBuilder *b = smbios_default;
+    SmbiosInfo *info;
+    SmbiosStructureInfoList **s_tail;
+    SmbiosPartInfoList **p_tail;
+    SmbiosTypeInfoList **t_tail;
+    SmbiosPart part;
+    size_t off = 0;
+    int type;
+
+    if (!b || !b->tables.data || b->deferred) {
+        error_setg(errp, "SMBIOS tables have not been built yet");
+        return NULL;
+    }
+
+    info = g_new0(SmbiosInfo, 1);
+    info->tables_length = b->tables.len;
+    info->entry_point = b->stats.ep_type;
+    info->auto_fallback = b->stats.auto_fallback;
+    info->build_time = b->stats.build_us;
+    info->allocations = b->stats.allocs;
+    info->cache_hit = b->stats.cache_hit;
+    info->shared = b->stats.shared;
+
+    s_tail = &info->structures;
+    while (off + sizeof(struct smbios_structure_header) <= b->tables.len) {
+        const uint8_t *p = b->tables.data + off;
+        const struct smbios_structure_header *header =
+            (const struct smbios_structure_header *)p;
+        size_t size = smbios_structure_size(p, b->tables.len - off);
+        SmbiosStructureInfo *st;
+
+        if (header->length < sizeof(*header) ||
+            size > b->tables.len - off) {
+            break;
+        }
+        st = g_new0(SmbiosStructureInfo, 1);
+        st->type = header->type;
+        st->handle = le16_to_cpu(header->handle);
+        st->length = header->length;
+        st->strings = smbios_structure_strings(p, size);
+        QAPI_LIST_APPEND(s_tail, st);
+        off += size;
+    }
+
+    p_tail = &info->parts;
+    for (part = 0; part < SMBIOS_PART__MAX; part++) {
+        SmbiosPartState *ps = &b->parts[part];
+        SmbiosPartInfo *pi;
+
+        if (!ps->built) {
+            continue;
+        }
+        pi = g_new0(SmbiosPartInfo, 1);
+        pi->name = g_strdup(smbios_part_info[part].name);
+        pi->types = g_strdup(smbios_part_info[part].types);
+        pi->reused = ps->reused;
+        pi->build_time = ps->build_us;
+        pi->allocations = ps->allocs;
+        QAPI_LIST_APPEND(p_tail, pi);
+    }
+
+    t_tail = &info->types;
+    for (type = 0; type <= SMBIOS_MAX_TYPE; type++) {
+        const SmbiosTypeStats *ts = &b->type_stats[type];
+        SmbiosTypeInfo *ti;
+
+        if (!ts->structures) {
+            continue;
+        }
+        ti = g_new0(SmbiosTypeInfo, 1);
+        ti->type = type;
+        ti->structures = ts->structures;
+        ti->build_time_ns = ts->build_ns;
+        ti->allocations = ts->allocs;
+        QAPI_LIST_APPEND(t_tail, ti);
+    }
+    return info;
+}
+
+bool smbios_builder_get_tables(SmbiosBuilder *b, MachineState *ms,
+                               SmbiosEntryPointType ep_type,
+                               const struct smbios_phys_mem_area *mem_array,
+                               const unsigned int mem_array_size,
+                               uint8_t **tables, size_t *tables_len,
+                               uint8_t **anchor, size_t *anchor_len,
+                               Error **errp)
+{
+    SmbiosTables *saved = smbios_tables;
+    bool ret;
+
+    switch (ep_type) {
+    case SMBIOS_ENTRY_POINT_TYPE_AUTO:
+    case SMBIOS_ENTRY_POINT_TYPE_32:
+    case SMBIOS_ENTRY_POINT_TYPE_64:
+        /* the table macros and type 38 write through smbios_tables */
+        smbios_tables = &b->tables;
+        ret = smbios_get_tables_ep(b, ms, ep_type, mem_array, mem_array_size,
+                                   tables, tables_len, anchor, anchor_len,
+                                   errp);
+        smbios_tables = saved;
+        return ret;
+    default:
+        abort();
+    }
+}
+
+/*
+ * Firmware can't look at the tables before the VM runs, so their build
+ * may wait until then: with '-smbios lazy=on', and on incoming migration
+ * with '-smbios migrate=on', where the source's tables are expected
+ * instead. Until then fw_cfg holds empty placeholders. The fw_cfg
+ * directory lists each file's size and firmware reads it before any
+ * file, so the tables can't wait for a select of their own file.
+ *
+ * With '-smbios migrate=on' the finished tables travel in the migration
+ * stream and in snapshots, so the destination hands the firmware exactly
+ * what the source did. Bus numbers of devices behind bridges stay as the
+ * source last patched them, which is what the migrated bridges are
+ * programmed with.
+ */
+static void smbios_fw_cfg_update(SmbiosBuilder *b, size_t anchor_len)
+{
+    FWCfgState *fw_cfg = fw_cfg_find();
+
+    if (fw_cfg) {
+        fw_cfg_modify_file(fw_cfg, "etc/smbios/smbios-tables",
+                           b->tables.data, b->tables.len);
+        fw_cfg_modify_file(fw_cfg, "etc/smbios/smbios-anchor",
+                           &b->ep, anchor_len);
+    }
+}
+
+/*
+ * Build the tables again with what smbios_get_tables() was given, for a
+ * build it put off or to apply set-smbios, and hand them to fw_cfg
+ */
+static bool smbios_rebuild(SmbiosBuilder *b)
 {
-    SMBIOS_BUILD_TABLE_PRE(32, T32_BASE, true); /* required */
+    uint8_t *tables, *anchor;
+    size_t tables_len, anchor_len;
+    Error *err = NULL;
+
+    b->deferred = false;
+    b->staged = false;
+    if (!smbios_builder_get_tables(b, current_machine, b->rebuild_ep_type,
+                                   b->rebuild_mem, b->rebuild_mem_size,
+                                   &tables, &tables_len, &anchor, &anchor_len,
+                                   &err)) {
+        error_report_err(err);
+        /* fw_cfg may still point at the previous tables, now freed */
+        b->tables.len = 0;
+        memset(&b->ep, 0, sizeof(b->ep));
+        smbios_fw_cfg_update(b, sizeof(struct smbios_30_entry_point));
+        return false;
+    }
+    smbios_fw_cfg_update(b, anchor_len);
+    usr_blobs = b->usr_blobs;
+    return true;
+}
 
-    memset(t->reserved, 0, 6);
-    t->boot_status = 0; /* No errors detected */
+static int smbios_pre_save(void *opaque)
+{
+    SmbiosBuilder *b = opaque;
 
-    SMBIOS_BUILD_TABLE_POST;
+    /* migrating on before the VM ever ran, with nothing received */
+    if (b->deferred && !smbios_rebuild(b)) {
+        return -EINVAL;
+    }
+    if (b->tables.len > UINT32_MAX) {
+        error_report("SMBIOS tables too large to migrate");
+        return -EINVAL;
+    }
+    /* borrowed for the duration of the save, see smbios_post_save() */
+    b->mig_tables = b->tables.data;
+    b->mig_tables_len = b->tables.len;
+    return 0;
 }
 
-static void smbios_build_type_41_table(Error **errp)
+static int smbios_post_save(void *opaque)
 {
-    unsigned instance = 0;
-    struct type41_instance *t41;
+    SmbiosBuilder *b = opaque;
 
-    QTAILQ_FOREACH(t41, &type41, next) {
-        SMBIOS_BUILD_TABLE_PRE(41, T41_BASE + instance, true);
+    b->mig_tables = NULL;
+    return 0;
+}
 
-        SMBIOS_TABLE_SET_STR(41, reference_designation_str, t41->designation);
-        t->device_type = t41->kind;
-        t->device_type_instance = t41->instance;
-        t->segment_group_number = cpu_to_le16(0);
-        t->bus_number = 0;
-        t->device_number = 0;
+static int smbios_post_load(void *opaque, int version_id)
+{
+    SmbiosBuilder *b = opaque;
+    size_t anchor_len = smbios_anchor_len(&b->ep);
+    SmbiosPart part;
 
-        if (t41->pcidev) {
-            PCIDevice *pdev = NULL;
-            int rc = pci_qdev_find_device(t41->pcidev, &pdev);
-            if (rc != 0) {
-                error_setg(errp,
-                           "No PCI device %s for SMBIOS type 41 entry %s",
-                           t41->pcidev, t41->designation);
-                return;
-            }
-            /*
-             * We only handle the case were the device is attached to
-             * the PCI root bus. The general case is more complex as
-             * bridges are enumerated later and the table would need
-             * to be updated at this moment.
-             */
-            if (!pci_bus_is_root(pci_get_bus(pdev))) {
-                error_setg(errp,
-                           "Cannot create type 41 entry for PCI device %s: "
-                           "not attached to the root bus",
-                           t41->pcidev);
-                return;
-            }
-            t->segment_group_number = cpu_to_le16(0);
-            t->bus_number = pci_dev_bus_num(pdev);
-            t->device_number = pdev->devfn;
-        }
+    if (!anchor_len) {
+        error_report("Invalid SMBIOS entry point in migration stream");
+        return -EINVAL;
+    }
 
-        SMBIOS_BUILD_TABLE_POST;
-        instance++;
+    /* the old tables' bus fixup offsets mean nothing in the new ones */
+    smbios_bus_fixups_reset(b);
+    smbios_tables_free(b);
+    b->tables.data = g_steal_pointer(&b->mig_tables);
+    b->tables.len = b->tables.size = b->mig_tables_len;
+    b->deferred = false;
+
+    /* nothing was built here, only the result is known */
+    memset(&b->stats, 0, sizeof(b->stats));
+    smbios_type_stats_reset(b);
+    for (part = 0; part < SMBIOS_PART__MAX; part++) {
+        b->parts[part].built = false;
     }
+    b->stats.ep_type = anchor_len == sizeof(struct smbios_21_entry_point) ?
+                       SMBIOS_ENTRY_POINT_TYPE_32 : SMBIOS_ENTRY_POINT_TYPE_64;
+    b->stats.tables_len = b->tables.len;
+    smbios_fw_cfg_update(b, anchor_len);
+    return 0;
 }
 
-static void smbios_build_type_127_table(void)
+static bool smbios_staged_needed(void *opaque)
 {
-    SMBIOS_BUILD_TABLE_PRE(127, T127_BASE, true); /* required */
-    SMBIOS_BUILD_TABLE_POST;
-}
+    SmbiosBuilder *b = opaque;
 
-void smbios_set_cpuid(uint32_t version, uint32_t features)
-{
-    smbios_cpuid_version = version;
-    smbios_cpuid_features = features;
+    return b->staged;
 }
 
-#define SMBIOS_SET_DEFAULT(field, value)                                  \
-    if (!field) {                                                         \
-        field = value;                                                    \
+/* a rebuild at the next reset is still pending, see smbios_reset() */
+static const VMStateDescription vmstate_smbios_staged = {
+    .name = "smbios/staged",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = smbios_staged_needed,
+    .fields = (const VMStateField[]) {
+        VMSTATE_BOOL(staged, SmbiosBuilder),
+        VMSTATE_END_OF_LIST()
     }
+};
 
-void smbios_set_default_processor_family(uint16_t processor_family)
-{
-    if (type4.processor_family <= 0x01) {
-        type4.processor_family = processor_family;
+static const VMStateDescription vmstate_smbios = {
+    .name = "smbios",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .pre_save = smbios_pre_save,
+    .post_save = smbios_post_save,
+    .post_load = smbios_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT32(mig_tables_len, SmbiosBuilder),
+        VMSTATE_VBUFFER_ALLOC_UINT32(mig_tables, SmbiosBuilder, 0, NULL,
+                                     mig_tables_len),
+        VMSTATE_BUFFER_UNSAFE(ep, SmbiosBuilder, 0, sizeof(SmbiosEntryPoint)),
+        VMSTATE_END_OF_LIST()
+    },
+    .subsections = (const VMStateDescription * const []) {
+        &vmstate_smbios_staged,
+        NULL
     }
-}
+};
 
-void smbios_set_defaults(const char *manufacturer, const char *product,
-                         const char *version,
-                         bool uuid_encoded)
+static void smbios_vm_state_change(void *opaque, bool running,
+                                   RunState state)
 {
-    smbios_have_defaults = true;
-    smbios_uuid_encoded = uuid_encoded;
-
-    SMBIOS_SET_DEFAULT(smbios_type1.manufacturer, "Maxsun"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(smbios_type1.product, "MS-Terminator B760M"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(smbios_type1.version, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type2.manufacturer, "Maxsun"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type2.product, "MS-Terminator B760M"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type2.version, "VER:H3.7G(2022/11/29)"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type3.manufacturer, "Default string"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type3.version, "Default string"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type4.sock_pfx, "CPU");
-    SMBIOS_SET_DEFAULT(type4.manufacturer, "Intel(R) Corporation"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type4.version, "12th Gen Intel(R) Core(TM) i7-12700"); //小迪SEC666 modify
-    SMBIOS_SET_DEFAULT(type17.loc_pfx, "DIMM");
-    SMBIOS_SET_DEFAULT(type17.manufacturer, "KINGSTON"); //小迪SEC666 modify
+    SmbiosBuilder *b = opaque;
 
+    /*
+     * Firmware is about to read the tables: booting it with none, as a
+     * failed build leaves fw_cfg, is what building them at startup with
+     * error_fatal prevented.
+     */
+    if (running && b->deferred && !smbios_rebuild(b)) {
+        exit(EXIT_FAILURE);
+    }
 }
 
-static void smbios_entry_point_setup(SmbiosEntryPointType ep_type)
+/*
+ * The firmware reads the tables again after a reset, the time to apply
+ * what set-smbios or hotplug changed. Not before: the guest may be
+ * looking at the tables. With '-smbios migrate=on' the destination
+ * learns that a rebuild is pending, but not what set-smbios staged.
+ */
+static void smbios_reset(void *opaque)
 {
-    switch (ep_type) {
-    case SMBIOS_ENTRY_POINT_TYPE_32:
-        memcpy(ep.ep21.anchor_string, "_SM_", 4);
-        memcpy(ep.ep21.intermediate_anchor_string, "_DMI_", 5);
-        ep.ep21.length = sizeof(struct smbios_21_entry_point);
-        ep.ep21.entry_point_revision = 0; /* formatted_area reserved */
-        memset(ep.ep21.formatted_area, 0, 5);
-
-        /* compliant with smbios spec v2.8 */
-        ep.ep21.smbios_major_version = 2;
-        ep.ep21.smbios_minor_version = 8;
-        ep.ep21.smbios_bcd_revision = 0x28;
-
-        /* set during table construction, but BIOS may override: */
-        ep.ep21.structure_table_length = cpu_to_le16(smbios_tables_len);
-        ep.ep21.max_structure_size = cpu_to_le16(smbios_table_max);
-        ep.ep21.number_of_structures = cpu_to_le16(smbios_table_cnt);
+    SmbiosBuilder *b = opaque;
 
-        /* BIOS must recalculate */
-        ep.ep21.checksum = 0;
-        ep.ep21.intermediate_checksum = 0;
-        ep.ep21.structure_table_address = cpu_to_le32(0);
-
-        break;
-    case SMBIOS_ENTRY_POINT_TYPE_64:
-        memcpy(ep.ep30.anchor_string, "_SM3_", 5);
-        ep.ep30.length = sizeof(struct smbios_30_entry_point);
-        ep.ep30.entry_point_revision = 1;
-        ep.ep30.reserved = 0;
+    /* keep the guest from booting without tables, the error says why */
+    if (b->staged && !b->deferred && !smbios_rebuild(b)) {
+        vm_stop(RUN_STATE_INTERNAL_ERROR);
+    }
+}
 
-        /* compliant with smbios spec 3.0 */
-        ep.ep30.smbios_major_version = 3;
-        ep.ep30.smbios_minor_version = 0;
-        ep.ep30.smbios_doc_rev = 0;
+/* Once the tables were built, apply a hotplug at the next reset */
+static void smbios_device_changed(SmbiosBuilder *b)
+{
+    if (b->reset_registered) {
+        b->staged = true;
+    }
+}
 
-        /* set during table construct, but BIOS might override */
-        ep.ep30.structure_table_max_size = cpu_to_le32(smbios_tables_len);
+void smbios_device_plug(DeviceState *dev)
+{
+    SmbiosBuilder *b = smbios_default_builder();
+
+    if (object_dynamic_cast(OBJECT(dev), TYPE_PC_DIMM) &&
+        !object_dynamic_cast(OBJECT(dev), TYPE_NVDIMM)) {
+        SmbiosDimm dimm = {
+            .dev = dev,
+            .addr = object_property_get_uint(OBJECT(dev), PC_DIMM_ADDR_PROP,
+                                             &error_abort),
+            .size = object_property_get_uint(OBJECT(dev), PC_DIMM_SIZE_PROP,
+                                             &error_abort),
+        };
+        guint i = 0;
+
+        while (i < b->dimms->len &&
+               g_array_index(b->dimms, SmbiosDimm, i).addr < dimm.addr) {
+            i++;
+        }
+        g_array_insert_val(b->dimms, i, dimm);
+    } else if (!object_dynamic_cast(OBJECT(dev), TYPE_CPU)) {
+        return;
+    }
+    smbios_device_changed(b);
+}
 
-        /* BIOS must recalculate */
-        ep.ep30.checksum = 0;
-        ep.ep30.structure_table_address = cpu_to_le64(0);
+void smbios_device_unplug(DeviceState *dev)
+{
+    SmbiosBuilder *b = smbios_default_builder();
+    guint i;
 
-        break;
-    default:
-        abort();
-        break;
+    /* its slot in possible_cpus is already empty */
+    if (object_dynamic_cast(OBJECT(dev), TYPE_CPU)) {
+        smbios_device_changed(b);
+        return;
+    }
+    for (i = 0; i < b->dimms->len; i++) {
+        if (g_array_index(b->dimms, SmbiosDimm, i).dev == dev) {
+            g_array_remove_index(b->dimms, i);
+            smbios_device_changed(b);
+            return;
+        }
     }
 }
 
-static bool smbios_get_tables_ep(MachineState *ms,
+void smbios_get_tables(MachineState *ms,
                        SmbiosEntryPointType ep_type,
                        const struct smbios_phys_mem_area *mem_array,
                        const unsigned int mem_array_size,
@@ -1259,211 +3826,121 @@ static bool smbios_get_tables_ep(MachineState *ms,
                        uint8_t **anchor, size_t *anchor_len,
                        Error **errp)
 {
-    unsigned i, dimm_cnt, offset;
-    ERRP_GUARD();
+    SmbiosBuilder *b = smbios_default_builder();
+
+    /* -uuid may have been given after the -smbios type=1 options */
+    if (qemu_uuid_set &&
+        (!b->uuid_set || !qemu_uuid_is_equal(&b->uuid, &qemu_uuid))) {
+        b->uuid = qemu_uuid;
+        b->uuid_set = true;
+        b->parts_dirty |= 1u << SMBIOS_PART_SYSTEM;
+    }
 
-    assert(ep_type == SMBIOS_ENTRY_POINT_TYPE_32 ||
-           ep_type == SMBIOS_ENTRY_POINT_TYPE_64);
+    if ((b->migrate || b->lazy) && !b->vm_state_entry) {
+        b->vm_state_entry =
+            qemu_add_vm_change_state_handler(smbios_vm_state_change, b);
+    }
+    if (b->migrate && !b->vmstate_registered) {
+        vmstate_register(NULL, 0, &vmstate_smbios, b);
+        b->vmstate_registered = true;
+    }
+    if (!b->reset_registered) {
+        qemu_register_reset(smbios_reset, b);
+        b->reset_registered = true;
+    }
 
-    g_free(smbios_tables);
-    smbios_type4_count = 0;
-    smbios_tables = g_memdup2(usr_blobs, usr_blobs_len);
-    smbios_tables_len = usr_blobs_len;
-    smbios_table_max = usr_table_max;
-    smbios_table_cnt = usr_table_cnt;
+    b->rebuild_ep_type = ep_type;
+    g_free(b->rebuild_mem);
+    b->rebuild_mem = g_memdup2(mem_array, mem_array_size * sizeof(*mem_array));
+    b->rebuild_mem_size = mem_array_size;
+    if (b->lazy || (b->migrate && runstate_check(RUN_STATE_INMIGRATE))) {
+        b->deferred = true;
+        memset(&b->ep, 0, sizeof(b->ep));
+        *tables = NULL;
+        *tables_len = 0;
+        *anchor = (uint8_t *)&b->ep;
+        *anchor_len = sizeof(struct smbios_30_entry_point);
+        return;
+    }
 
-    smbios_build_type_0_table();
-    smbios_build_type_1_table();
-    smbios_build_type_2_table();
-    smbios_build_type_3_table();
+    smbios_builder_get_tables(b, ms, ep_type, mem_array, mem_array_size,
+                              tables, tables_len, anchor, anchor_len, errp);
+    /* the tables were built in the file= blobs' buffer, it may have moved */
+    usr_blobs = b->usr_blobs;
+}
 
-    assert(ms->smp.sockets >= 1);
+/* Replace the values of option @name in QemuOpts @opaque by @value */
+static int smbios_staged_opt_set(void *opaque, const char *name,
+                                 const char *value, Error **errp)
+{
+    QemuOpts *staged = opaque;
 
-    for (i = 0; i < ms->smp.sockets; i++) {
-        smbios_build_type_4_table(ms, i, ep_type, errp);
-        if (*errp) {
-            goto err_exit;
-        }
+    while (qemu_opt_unset(staged, name) == 0) {
+        /* earlier calls' value */
     }
-	//小迪SEC666 added
-	//unsigned instance,const char *socket_designation,uint16_t cache_configuration,uint16_t max_cache_size,uint8_t error_correction,uint8_t system_cache_type,uint8_t associativity
-	/*
-	cach1 example
-	t->cache_configuration=0x180; 180代表Write Back,Enabled,Internal,Not Socketed,L1
-	t->max_cache_size=0x100; 100是256KB
-	t->installed_size=0x100; 100是256KB
-	t->supported_sram_type=0x20;  Synchronous
-	t->current_sram_type=0x20; Synchronous
-	t->cache_speed=0x0; unknown
-	t->error_correction=0x4; Parity
-	t->system_cache_type=0x4; Data
-	t->associativity=0x9; 12-way Set-Associative
-	*/
-	unsigned cores_per_socket = machine_topo_get_cores_per_socket(ms);
-	smbios_build_type_7_table(0,"L1 Cache",0x180,cores_per_socket*0x20,0x4,0x4,0x7); //小迪SEC666 added 设置1级数据缓存，每个核心32kb
-	smbios_build_type_7_table(1,"L1 Cache",0x180,cores_per_socket*0x20,0x4,0x3,0x7); //小迪SEC666 added 设置1级指令缓存，每个核心32kb
-	smbios_build_type_7_table(2,"L2 Cache",0x181,cores_per_socket*0x800,0x5,0x4,0x8); //小迪SEC666 added 设置2级数据缓存，每个核心2m
-	smbios_build_type_7_table(3,"L2 Cache",0x181,cores_per_socket*0x800,0x5,0x3,0x8); //小迪SEC666 added 设置2级指令缓存，每个核心2m
-	smbios_build_type_7_table(4,"L3 Cache",0x182,0x2000,0x6,0x5,0x8); //小迪SEC666 added 设置3级Unified缓存，8M
-	smbios_build_type_7_table(5,"L3 Cache",0x182,0x2000,0x6,0x5,0x8); //小迪SEC666 added 设置3级Unified缓存，8M
-	smbios_build_type_7_table(6,"lixiaoliu L4 Cache",0x183,0x4000,0x6,0x5,0x1); //小迪SEC666 added 设置4级Unified缓存，16M
-
-
-    smbios_build_type_8_table();
-    smbios_build_type_9_table(errp);
-    smbios_build_type_11_table();
-
-#define MAX_DIMM_SZ (16 * GiB)
-#define GET_DIMM_SZ ((i < dimm_cnt - 1) ? MAX_DIMM_SZ \
-                                        : ((current_machine->ram_size - 1) % MAX_DIMM_SZ) + 1)
-
-    dimm_cnt = QEMU_ALIGN_UP(current_machine->ram_size, MAX_DIMM_SZ) /
-               MAX_DIMM_SZ;
-
-    /*
-     * The offset determines if we need to keep additional space between
-     * table 17 and table 19 header handle numbers so that they do
-     * not overlap. For example, for a VM with larger than 8 TB guest
-     * memory and DIMM like chunks of 16 GiB, the default space between
-     * the two tables (T19_BASE - T17_BASE = 512) is not enough.
-     */
-    offset = (dimm_cnt > (T19_BASE - T17_BASE)) ? \
-             dimm_cnt - (T19_BASE - T17_BASE) : 0;
+    return qemu_opt_set(staged, name, value, errp) ? 0 : -1;
+}
 
-    smbios_build_type_16_table(dimm_cnt);
+void qmp_set_smbios(const char *options, Error **errp)
+{
+    static const QemuOptDesc *const type_opts[] = {
+        qemu_smbios_type0_opts, qemu_smbios_type1_opts,
+        qemu_smbios_type2_opts, qemu_smbios_type3_opts,
+    };
+    SmbiosBuilder *b = smbios_default;
+    SmbiosBuilder *check;
+    Error *err = NULL;
+    unsigned long type;
+    QemuOpts *opts;
+    const char *val;
 
-    for (i = 0; i < dimm_cnt; i++) {
-        smbios_build_type_17_table(i, GET_DIMM_SZ);
+    if (!b || !b->reset_registered) {
+        error_setg(errp, "This machine's SMBIOS tables can't be changed");
+        return;
     }
 
-    for (i = 0; i < dimm_cnt; i++) {//小迪SEC666 modify mem_array_size改为dimm_cnt，减少type19 出现次数
-        smbios_build_type_19_table(i, offset, mem_array[i].address,
-                                   GET_DIMM_SZ);//小迪SEC666 modify mem_array[i].length改为GET_DIMM_SZ做单条处理，我这里也只想最大内存16G就单条
-		smbios_build_type_20_table(mem_array[i].address,
-                                   GET_DIMM_SZ);//小迪SEC666 added 生成内存设备映射地址信息 我这里也只想最大内存16G就单条
+    opts = qemu_opts_parse(qemu_find_opts("smbios"), options, false, errp);
+    if (!opts) {
+        return;
     }
-	smbios_build_type_22_table();/* SMBIOS type 22 PortableBattery （这个没有写完） 小迪SEC666 added*/
-    /*
-     * make sure 16 bit handle numbers in the headers of tables 19
-     * and 32 do not overlap.
-     */
-    assert((mem_array_size + offset) < (T32_BASE - T19_BASE));
-
-	//小迪SEC666 added VoltageProbe
-	//(unsigned instance,const char *description,uint8_t location_and_status)t->location_and_status=0x6A;
-	//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 26 内部参数信息
-	smbios_build_type_26_table(0,"LM78A",0x6A);//小迪SEC666 added
-	smbios_build_type_26_table(1,"LM78A",0x67);//小迪SEC666 added
-	smbios_build_type_26_table(2,"dds666",0x63);//小迪SEC666 added
-	smbios_build_type_26_table(3,"dds666",0x64);//小迪SEC666 added
-	smbios_build_type_26_table(4,"lixiaoliu",0x63);//小迪SEC666 added
-	smbios_build_type_26_table(5,"lixiaoliu",0x64);//小迪SEC666 added
-	smbios_build_type_26_table(6,"lixiaoliu",0x6A);//小迪SEC666 added
-	smbios_build_type_26_table(7,"lixiaoliu",0x67);//小迪SEC666 added
-
-	//小迪SEC666 added CoolingDevice
-	//(unsigned instance,const char *description,uint8_t device_type_and_status) t->device_type_and_status = 0x67; //Power Supply Fan |  Ok   0x67=b01100111
-	//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 27 内部参数信息
-	smbios_build_type_27_table(0,"CPU FAN",0x67);//小迪SEC666 added
-	smbios_build_type_27_table(1,"dds666",0x65);//小迪SEC666 added
-	smbios_build_type_27_table(2,"dds666",0x63);//小迪SEC666 added
-	smbios_build_type_27_table(3,"lixiaoliu",0x65);//小迪SEC666 added
-	smbios_build_type_27_table(4,"lixiaoliu",0x63);//小迪SEC666 added
-	smbios_build_type_27_table(5,"lixiaoliu",0x67);//小迪SEC666 added
-
-	//小迪SEC666 added TemperatureProbe
-	//unsigned instance,const char *description,uint8_t location_and_status) t->location_and_status=0x6A;
-	//https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 28 内部参数信息
-	smbios_build_type_28_table(0,"LM78A",0x63);//小迪SEC666 added
-	smbios_build_type_28_table(1,"LM78A",0x6A);//小迪SEC666 added
-	smbios_build_type_28_table(2,"dds666",0x67);//小迪SEC666 added
-	smbios_build_type_28_table(3,"lixiaoliu",0x67);//小迪SEC666 added
-	smbios_build_type_28_table(4,"lixiaoliu",0x69);//小迪SEC666 added
-	smbios_build_type_28_table(5,"lixiaoliu",0x63);//小迪SEC666 added
-	smbios_build_type_28_table(6,"lixiaoliu",0x6A);//小迪SEC666 added
-	smbios_build_type_29_table();//小迪SEC666 added ElectricalCurrentProbe
-
-
-
-
-    smbios_build_type_32_table();
-	smbios_build_type_37_table();//小迪SEC666 added MemoryChannel
-    smbios_build_type_38_table();
-	smbios_build_type_39_table();//小迪SEC666 added SystemPowerSupply
-    smbios_build_type_41_table(errp);
-    smbios_build_type_127_table();
-
-    if (!smbios_check_type4_count(ms->smp.sockets, errp)) {
-        goto err_exit;
+    val = qemu_opt_get(opts, "type");
+    if (!val || qemu_strtoul(val, NULL, 0, &type) < 0 ||
+        type >= ARRAY_SIZE(type_opts) || qemu_opt_get(opts, "uuid")) {
+        error_setg(errp, "Only the fields of types 0 to 3 can be changed, "
+                   "the UUID aside");
+        goto out;
     }
-    if (!smbios_validate_table(ep_type, errp)) {
-        goto err_exit;
+    if (!qemu_opts_validate(opts, type_opts[type], errp)) {
+        goto out;
     }
-    smbios_entry_point_setup(ep_type);
-
-    /* return tables blob and entry point (anchor), and their sizes */
-    *tables = smbios_tables;
-    *tables_len = smbios_tables_len;
-    *anchor = (uint8_t *)&ep;
-    /* calculate length based on anchor string */
-    if (!strncmp((char *)&ep, "_SM_", 4)) {
-        *anchor_len = sizeof(struct smbios_21_entry_point);
-    } else if (!strncmp((char *)&ep, "_SM3_", 5)) {
-        *anchor_len = sizeof(struct smbios_30_entry_point);
-    } else {
-        abort();
+    if (test_bit(type, b->have_binfile_bitmap)) {
+        error_setg(errp, "can't add fields, binary file already loaded!");
+        goto out;
     }
 
-    return true;
-err_exit:
-    g_free(smbios_tables);
-    smbios_tables = NULL;
-    return false;
-}
-
-void smbios_get_tables(MachineState *ms,
-                       SmbiosEntryPointType ep_type,
-                       const struct smbios_phys_mem_area *mem_array,
-                       const unsigned int mem_array_size,
-                       uint8_t **tables, size_t *tables_len,
-                       uint8_t **anchor, size_t *anchor_len,
-                       Error **errp)
-{
-    Error *local_err = NULL;
-    bool is_valid;
-    ERRP_GUARD();
-
-    switch (ep_type) {
-    case SMBIOS_ENTRY_POINT_TYPE_AUTO:
-    case SMBIOS_ENTRY_POINT_TYPE_32:
-        is_valid = smbios_get_tables_ep(ms, SMBIOS_ENTRY_POINT_TYPE_32,
-                                        mem_array, mem_array_size,
-                                        tables, tables_len,
-                                        anchor, anchor_len,
-                                        &local_err);
-        if (is_valid || ep_type != SMBIOS_ENTRY_POINT_TYPE_AUTO) {
-            break;
-        }
-        /*
-         * fall through in case AUTO endpoint is selected and
-         * SMBIOS 2.x tables can't be generated, to try if SMBIOS 3.x
-         * tables would work
-         */
-    case SMBIOS_ENTRY_POINT_TYPE_64:
-        error_free(local_err);
-        local_err = NULL;
-        is_valid = smbios_get_tables_ep(ms, SMBIOS_ENTRY_POINT_TYPE_64,
-                                        mem_array, mem_array_size,
-                                        tables, tables_len,
-                                        anchor, anchor_len,
-                                        &local_err);
-        break;
-    default:
-        abort();
+    /* values that don't parse must leave @b as it was */
+    check = smbios_builder_new();
+    smbios_builder_entry_add(check, opts, &err);
+    smbios_builder_free(check);
+    if (err) {
+        error_propagate(errp, err);
+        goto out;
     }
-    if (!is_valid) {
-        error_propagate(errp, local_err);
+
+    /*
+     * @b points into what set-smbios staged for @type before: fold @opts
+     * into that rather than keeping every call's options around.
+     */
+    if (b->staged_opts[type]) {
+        qemu_opt_foreach(opts, smbios_staged_opt_set, b->staged_opts[type],
+                         &error_abort);
+    } else {
+        b->staged_opts[type] = g_steal_pointer(&opts);
     }
+    smbios_builder_entry_add(b, b->staged_opts[type], &error_abort);
+    b->staged = true;
+out:
+    qemu_opts_del(opts);
 }
 
 static void save_opt(const char **dest, QemuOpts *opts, const char *name)
@@ -1488,16 +3965,25 @@ static int save_opt_one(void *opaque,
     struct opt_list *opt = opaque;
 
     if (g_str_equal(name, "path")) {
-        g_autoptr(GByteArray) data = g_byte_array_new();
-        g_autofree char *buf = g_new(char, 4096);
+        g_autofree char *data = NULL;
+        size_t size, len = 0;
+        struct stat st;
         ssize_t ret;
         int fd = qemu_open(value, O_RDONLY, errp);
         if (fd < 0) {
             return -1;
         }
 
+        /*
+         * Size the buffer from fstat, with a byte to spare so that the
+         * read hitting EOF doesn't grow it: a regular file is read in
+         * one go. Anything not reporting a size grows the buffer.
+         */
+        size = (fstat(fd, &st) == 0 && st.st_size > 0 ? st.st_size : 4096) + 1;
+        data = g_malloc(size + 1);
+
         while (1) {
-            ret = read(fd, buf, 4096);
+            ret = read(fd, data + len, size - len);
             if (ret == 0) {
                 break;
             }
@@ -1507,20 +3993,24 @@ static int save_opt_one(void *opaque,
                 qemu_close(fd);
                 return -1;
             }
-            if (memchr(buf, '\0', ret)) {
-                error_setg(errp, "NUL in OEM strings value in %s", value);
-                qemu_close(fd);
-                return -1;
+            len += ret;
+            if (len == size) {
+                size *= 2;
+                data = g_realloc(data, size + 1);
             }
-            g_byte_array_append(data, (guint8 *)buf, ret);
         }
 
         qemu_close(fd);
 
+        if (memchr(data, '\0', len)) {
+            error_setg(errp, "NUL in OEM strings value in %s", value);
+            return -1;
+        }
+        data[len] = '\0';
+
         *opt->dest = g_renew(char *, *opt->dest, (*opt->ndest) + 1);
-        (*opt->dest)[*opt->ndest] = (char *)g_byte_array_free(data,  FALSE);
+        (*opt->dest)[*opt->ndest] = g_steal_pointer(&data);
         (*opt->ndest)++;
-        data = NULL;
    } else if (g_str_equal(name, "value")) {
         *opt->dest = g_renew(char *, *opt->dest, (*opt->ndest) + 1);
         (*opt->dest)[*opt->ndest] = g_strdup(value);
@@ -1545,165 +4035,279 @@ static bool save_opt_list(size_t *ndest, char ***dest, QemuOpts *opts,
     return true;
 }
 
-void smbios_entry_add(QemuOpts *opts, Error **errp)
+static guint smbios_usr_blob_hash(gconstpointer key)
+{
+    const SmbiosUsrBlob *blob = key;
+    const uint8_t *p = blob->b->usr_blobs + blob->offset;
+    guint hash = 2166136261u; /* FNV-1a */
+    size_t i;
+
+    for (i = 0; i < blob->size; i++) {
+        hash = (hash ^ p[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static gboolean smbios_usr_blob_equal(gconstpointer a, gconstpointer b)
+{
+    const SmbiosUsrBlob *blob_a = a, *blob_b = b;
+    const uint8_t *usr_blobs = blob_a->b->usr_blobs;
+
+    return blob_a->size == blob_b->size &&
+           !memcmp(usr_blobs + blob_a->offset, usr_blobs + blob_b->offset,
+                   blob_a->size);
+}
+
+/*
+ * Map the file= blob at @path and append it to usr_blobs, which grows
+ * geometrically so that loading many blobs stays linear. usr_blobs has
+ * to remain one contiguous buffer, the legacy fw_cfg layout is built
+ * straight from it, and the tables are built behind the blobs. Returns
+ * the new blob's header, which is only committed by the caller advancing
+ * usr_blobs_len, or NULL on error.
+ */
+static struct smbios_structure_header *
+smbios_usr_blob_load(SmbiosBuilder *b, const char *path, size_t *size,
+                     Error **errp)
+{
+    g_autoptr(GError) err = NULL;
+    GMappedFile *mapped;
+    uint8_t *p;
+
+    mapped = g_mapped_file_new(path, FALSE, &err);
+    if (!mapped) {
+        error_setg(errp, "Cannot read SMBIOS file %s: %s", path, err->message);
+        return NULL;
+    }
+
+    *size = g_mapped_file_get_length(mapped);
+    if (*size < sizeof(struct smbios_structure_header)) {
+        error_setg(errp, "Cannot read SMBIOS file %s", path);
+        g_mapped_file_unref(mapped);
+        return NULL;
+    }
+
+    /* a previous build behind the blobs is about to be overwritten */
+    if (b->tables.data == b->usr_blobs) {
+        smbios_tables_free(b);
+    }
+    if (b->usr_blobs_len + *size > b->usr_blobs_size) {
+        b->usr_blobs_size = MAX(b->usr_blobs_len + *size,
+                                b->usr_blobs_size * 2);
+        b->usr_blobs = g_realloc(b->usr_blobs, b->usr_blobs_size);
+    }
+    p = b->usr_blobs + b->usr_blobs_len;
+    memcpy(p, g_mapped_file_get_contents(mapped), *size);
+    g_mapped_file_unref(mapped);
+
+    return (struct smbios_structure_header *)p;
+}
+
+void smbios_builder_entry_add(SmbiosBuilder *b, QemuOpts *opts,
+                              Error **errp)
 {
     const char *val;
 
     val = qemu_opt_get(opts, "file");
     if (val) {
         struct smbios_structure_header *header;
+        SmbiosUsrBlob *blob;
         size_t size;
 
         if (!qemu_opts_validate(opts, qemu_smbios_file_opts, errp)) {
             return;
         }
 
-        size = get_image_size(val);
-        if (size == -1 || size < sizeof(struct smbios_structure_header)) {
-            error_setg(errp, "Cannot read SMBIOS file %s", val);
-            return;
-        }
-
         /*
          * NOTE: standard double '\0' terminator expected, per smbios spec.
          * (except in legacy mode, where the second '\0' is implicit and
          *  will be inserted by the BIOS).
          */
-        usr_blobs = g_realloc(usr_blobs, usr_blobs_len + size);
-        header = (struct smbios_structure_header *)(usr_blobs +
-                                                    usr_blobs_len);
-
-        if (load_image_size(val, (uint8_t *)header, size) != size) {
-            error_setg(errp, "Failed to load SMBIOS file %s", val);
+        header = smbios_usr_blob_load(b, val, &size, errp);
+        if (!header) {
             return;
         }
 
         if (header->type <= SMBIOS_MAX_TYPE) {
-            if (test_bit(header->type, smbios_have_fields_bitmap)) {
+            if (test_bit(header->type, b->have_fields_bitmap)) {
                 error_setg(errp,
                            "can't load type %d struct, fields already specified!",
                            header->type);
                 return;
             }
-            set_bit(header->type, smbios_have_binfile_bitmap);
+            set_bit(header->type, b->have_binfile_bitmap);
+        }
+
+        /* a blob identical to an earlier one would only repeat its handle */
+        if (!b->usr_blobs_index) {
+            b->usr_blobs_index = g_hash_table_new_full(smbios_usr_blob_hash,
+                                                       smbios_usr_blob_equal,
+                                                       g_free, NULL);
         }
+        blob = g_new(SmbiosUsrBlob, 1);
+        blob->b = b;
+        blob->offset = b->usr_blobs_len;
+        blob->size = size;
+        if (g_hash_table_contains(b->usr_blobs_index, blob)) {
+            g_free(blob);
+            return;
+        }
+        g_hash_table_add(b->usr_blobs_index, blob);
 
         if (header->type == 4) {
-            smbios_type4_count++;
+            b->type4_count++;
         }
 
         /*
          * preserve blob size for legacy mode so it could build its
          * blobs flavor from 'usr_blobs'
          */
-        smbios_add_usr_blob_size(size);
+        if (b->machine) {
+            smbios_add_usr_blob_size(size);
+        }
+
+        b->usr_blobs_len += size;
+        if (size > b->usr_table_max) {
+            b->usr_table_max = size;
+        }
+        b->usr_table_cnt++;
+        b->parts_dirty = SMBIOS_PARTS_ALL;
+
+        return;
+    }
 
-        usr_blobs_len += size;
-        if (size > usr_table_max) {
-            usr_table_max = size;
+    val = qemu_opt_get(opts, "cache-dir");
+    if (val) {
+        if (!qemu_opts_validate(opts, qemu_smbios_cache_opts, errp)) {
+            return;
+        }
+        g_free(b->cache_dir);
+        b->cache_dir = g_strdup(val);
+        return;
+    }
+
+    val = qemu_opt_get(opts, "share-dir");
+    if (val) {
+        if (!qemu_opts_validate(opts, qemu_smbios_share_opts, errp)) {
+            return;
         }
-        usr_table_cnt++;
+        g_free(b->share_dir);
+        b->share_dir = g_strdup(val);
+        return;
+    }
 
+    if (qemu_opt_get(opts, "migrate") || qemu_opt_get(opts, "lazy")) {
+        if (!qemu_opts_validate(opts, qemu_smbios_build_opts, errp)) {
+            return;
+        }
+        b->migrate = qemu_opt_get_bool(opts, "migrate", b->migrate);
+        b->lazy = qemu_opt_get_bool(opts, "lazy", b->lazy);
         return;
     }
 
     val = qemu_opt_get(opts, "type");
     if (val) {
-        unsigned long type = strtoul(val, NULL, 0);
+        unsigned long type;
 
+        if (qemu_strtoul(val, NULL, 0, &type) < 0) {
+            error_setg(errp, "Invalid type '%s'", val);
+            return;
+        }
         if (type > SMBIOS_MAX_TYPE) {
             error_setg(errp, "out of range!");
             return;
         }
 
-        if (test_bit(type, smbios_have_binfile_bitmap)) {
+        if (test_bit(type, b->have_binfile_bitmap)) {
             error_setg(errp, "can't add fields, binary file already loaded!");
             return;
         }
-        set_bit(type, smbios_have_fields_bitmap);
+        set_bit(type, b->have_fields_bitmap);
+        b->parts_dirty |= smbios_type_parts(type);
 
         switch (type) {
         case 0:
             if (!qemu_opts_validate(opts, qemu_smbios_type0_opts, errp)) {
                 return;
             }
-            save_opt(&smbios_type0.vendor, opts, "vendor");
-            save_opt(&smbios_type0.version, opts, "version");
-            save_opt(&smbios_type0.date, opts, "date");
-            smbios_type0.uefi = qemu_opt_get_bool(opts, "uefi", false);
+            save_opt(&b->type0.vendor, opts, "vendor");
+            save_opt(&b->type0.version, opts, "version");
+            save_opt(&b->type0.date, opts, "date");
+            b->type0.uefi = qemu_opt_get_bool(opts, "uefi", b->type0.uefi);
 
             val = qemu_opt_get(opts, "release");
             if (val) {
-                if (sscanf(val, "%hhu.%hhu", &smbios_type0.major,
-                           &smbios_type0.minor) != 2) {
+                if (sscanf(val, "%hhu.%hhu", &b->type0.major,
+                           &b->type0.minor) != 2) {
                     error_setg(errp, "Invalid release");
                     return;
                 }
-                smbios_type0.have_major_minor = true;
+                b->type0.have_major_minor = true;
             }
             return;
         case 1:
             if (!qemu_opts_validate(opts, qemu_smbios_type1_opts, errp)) {
                 return;
             }
-            save_opt(&smbios_type1.manufacturer, opts, "manufacturer");
-            save_opt(&smbios_type1.product, opts, "product");
-            save_opt(&smbios_type1.version, opts, "version");
-            save_opt(&smbios_type1.serial, opts, "serial");
-            save_opt(&smbios_type1.sku, opts, "sku");
-            save_opt(&smbios_type1.family, opts, "family");
+            save_opt(&b->type1.manufacturer, opts, "manufacturer");
+            save_opt(&b->type1.product, opts, "product");
+            save_opt(&b->type1.version, opts, "version");
+            save_opt(&b->type1.serial, opts, "serial");
+            save_opt(&b->type1.sku, opts, "sku");
+            save_opt(&b->type1.family, opts, "family");
 
             val = qemu_opt_get(opts, "uuid");
             if (val) {
-                if (qemu_uuid_parse(val, &qemu_uuid) != 0) {
+                if (qemu_uuid_parse(val, &b->uuid) != 0) {
                     error_setg(errp, "Invalid UUID");
                     return;
                 }
-                qemu_uuid_set = true;
+                b->uuid_set = true;
             }
             return;
         case 2:
             if (!qemu_opts_validate(opts, qemu_smbios_type2_opts, errp)) {
                 return;
             }
-            save_opt(&type2.manufacturer, opts, "manufacturer");
-            save_opt(&type2.product, opts, "product");
-            save_opt(&type2.version, opts, "version");
-            save_opt(&type2.serial, opts, "serial");
-            save_opt(&type2.asset, opts, "asset");
-            save_opt(&type2.location, opts, "location");
+            save_opt(&b->type2.manufacturer, opts, "manufacturer");
+            save_opt(&b->type2.product, opts, "product");
+            save_opt(&b->type2.version, opts, "version");
+            save_opt(&b->type2.serial, opts, "serial");
+            save_opt(&b->type2.asset, opts, "asset");
+            save_opt(&b->type2.location, opts, "location");
             return;
         case 3:
             if (!qemu_opts_validate(opts, qemu_smbios_type3_opts, errp)) {
                 return;
             }
-            save_opt(&type3.manufacturer, opts, "manufacturer");
-            save_opt(&type3.version, opts, "version");
-            save_opt(&type3.serial, opts, "serial");
-            save_opt(&type3.asset, opts, "asset");
-            save_opt(&type3.sku, opts, "sku");
+            save_opt(&b->type3.manufacturer, opts, "manufacturer");
+            save_opt(&b->type3.version, opts, "version");
+            save_opt(&b->type3.serial, opts, "serial");
+            save_opt(&b->type3.asset, opts, "asset");
+            save_opt(&b->type3.sku, opts, "sku");
             return;
         case 4:
             if (!qemu_opts_validate(opts, qemu_smbios_type4_opts, errp)) {
                 return;
             }
-            save_opt(&type4.sock_pfx, opts, "sock_pfx");
-            type4.processor_family = qemu_opt_get_number(opts,
+            save_opt(&b->type4.sock_pfx, opts, "sock_pfx");
+            b->type4.processor_family = qemu_opt_get_number(opts,
                                                          "processor-family",
                                                          0x01 /* Other */);
-            save_opt(&type4.manufacturer, opts, "manufacturer");
-            save_opt(&type4.version, opts, "version");
-            save_opt(&type4.serial, opts, "serial");
-            save_opt(&type4.asset, opts, "asset");
-            save_opt(&type4.part, opts, "part");
+            save_opt(&b->type4.manufacturer, opts, "manufacturer");
+            save_opt(&b->type4.version, opts, "version");
+            save_opt(&b->type4.serial, opts, "serial");
+            save_opt(&b->type4.asset, opts, "asset");
+            save_opt(&b->type4.part, opts, "part");
             /* If the value is 0, it will take the value from the CPU model. */
-            type4.processor_id = qemu_opt_get_number(opts, "processor-id", 0);
-            type4.max_speed = qemu_opt_get_number(opts, "max-speed",
+            b->type4.processor_id = qemu_opt_get_number(opts, "processor-id",
+                                                        0);
+            b->type4.max_speed = qemu_opt_get_number(opts, "max-speed",
                                                   DEFAULT_CPU_SPEED);
-            type4.current_speed = qemu_opt_get_number(opts, "current-speed",
+            b->type4.current_speed = qemu_opt_get_number(opts, "current-speed",
                                                       DEFAULT_CPU_SPEED);
-            if (type4.max_speed > UINT16_MAX ||
-                type4.current_speed > UINT16_MAX) {
+            if (b->type4.max_speed > UINT16_MAX ||
+                b->type4.current_speed > UINT16_MAX) {
                 error_setg(errp, "SMBIOS CPU speed is too large (> %d)",
                            UINT16_MAX);
             }
@@ -1719,7 +4323,7 @@ void smbios_entry_add(QemuOpts *opts, Error **errp)
             t8_i->connector_type = qemu_opt_get_number(opts,
                                                        "connector_type", 0);
             t8_i->port_type = qemu_opt_get_number(opts, "port_type", 0);
-            QTAILQ_INSERT_TAIL(&type8, t8_i, next);
+            QTAILQ_INSERT_TAIL(&b->type8, t8_i, next);
             return;
         case 9: {
             if (!qemu_opts_validate(opts, qemu_smbios_type9_opts, errp)) {
@@ -1739,14 +4343,15 @@ void smbios_entry_add(QemuOpts *opts, Error **errp)
             t->slot_characteristics2 =
                 qemu_opt_get_number(opts, "slot_characteristics2", 0);
             save_opt(&t->pcidev, opts, "pcidev");
-            QTAILQ_INSERT_TAIL(&type9, t, next);
+            QTAILQ_INSERT_TAIL(&b->type9, t, next);
             return;
         }
         case 11:
             if (!qemu_opts_validate(opts, qemu_smbios_type11_opts, errp)) {
                 return;
             }
-            if (!save_opt_list(&type11.nvalues, &type11.values, opts, errp)) {
+            if (!save_opt_list(&b->type11.nvalues, &b->type11.values, opts,
+                               errp)) {
                 return;
             }
             return;
@@ -1754,13 +4359,19 @@ void smbios_entry_add(QemuOpts *opts, Error **errp)
             if (!qemu_opts_validate(opts, qemu_smbios_type17_opts, errp)) {
                 return;
             }
-            save_opt(&type17.loc_pfx, opts, "loc_pfx");
-            save_opt(&type17.bank, opts, "bank");
-            save_opt(&type17.manufacturer, opts, "manufacturer");
-            save_opt(&type17.serial, opts, "serial");
-            save_opt(&type17.asset, opts, "asset");
-            save_opt(&type17.part, opts, "part");
-            type17.speed = qemu_opt_get_number(opts, "speed", 0);
+            save_opt(&b->type17.loc_pfx, opts, "loc_pfx");
+            save_opt(&b->type17.bank, opts, "bank");
+            save_opt(&b->type17.manufacturer, opts, "manufacturer");
+            save_opt(&b->type17.serial, opts, "serial");
+            save_opt(&b->type17.asset, opts, "asset");
+            save_opt(&b->type17.part, opts, "part");
+            b->type17.speed = qemu_opt_get_number(opts, "speed", 0);
+            b->type17.dimm_size = qemu_opt_get_size(opts, "dimm-size", 0);
+            if (b->type17.dimm_size % MiB) {
+                error_setg(errp, "SMBIOS type 17 dimm-size must be a "
+                           "multiple of 1 MiB");
+                return;
+            }
             return;
         case 41: {
             struct type41_instance *t41_i;
@@ -1783,7 +4394,7 @@ void smbios_entry_add(QemuOpts *opts, Error **errp)
             t41_i->instance = qemu_opt_get_number(opts, "instance", 1);
             save_opt(&t41_i->pcidev, opts, "pcidev");
 
-            QTAILQ_INSERT_TAIL(&type41, t41_i, next);
+            QTAILQ_INSERT_TAIL(&b->type41, t41_i, next);
             return;
         }
         default:
@@ -1796,3 +4407,116 @@ void smbios_entry_add(QemuOpts *opts, Error **errp)
 
     error_setg(errp, "Must specify type= or file=");
 }
+
+void smbios_entry_add(QemuOpts *opts, Error **errp)
+{
+    SmbiosBuilder *b = smbios_default_builder();
+
+    smbios_builder_entry_add(b, opts, errp);
+
+    /* keep legacy mode's view of the -smbios options in sync */
+    usr_blobs = b->usr_blobs;
+    usr_blobs_len = b->usr_blobs_len;
+    bitmap_copy(smbios_have_binfile_bitmap, b->have_binfile_bitmap,
+                SMBIOS_MAX_TYPE + 1);
+    bitmap_copy(smbios_have_fields_bitmap, b->have_fields_bitmap,
+                SMBIOS_MAX_TYPE + 1);
+    smbios_type0 = b->type0;
+    smbios_type1 = b->type1;
+    if (b->uuid_set) {
+        qemu_uuid = b->uuid;
+        qemu_uuid_set = true;
+    }
+}
+
+SmbiosBuilder *smbios_builder_new(void)
+{
+    SmbiosBuilder *b = g_new0(SmbiosBuilder, 1);
+
+    b->uuid_encoded = true;
+    b->type4.max_speed = DEFAULT_CPU_SPEED;
+    b->type4.current_speed = DEFAULT_CPU_SPEED;
+    b->type4.processor_family = 0x01; /* Other */
+    QTAILQ_INIT(&b->type8);
+    QTAILQ_INIT(&b->type9);
+    QTAILQ_INIT(&b->type41);
+    b->bus_fixups = g_array_new(false, false, sizeof(SmbiosBusFixup));
+    b->dimms = g_array_new(false, false, sizeof(SmbiosDimm));
+    b->parts_dirty = SMBIOS_PARTS_ALL;
+    b->share_fd = -1;
+    return b;
+}
+
+void smbios_builder_free(SmbiosBuilder *b)
+{
+    struct type8_instance *t8, *t8_next;
+    struct type9_instance *t9, *t9_next;
+    struct type41_instance *t41, *t41_next;
+    unsigned i;
+
+    if (!b) {
+        return;
+    }
+    if (b == smbios_default) {
+        smbios_default = NULL;
+    }
+
+    smbios_bus_fixups_reset(b);
+    g_array_free(b->bus_fixups, true);
+    g_array_free(b->dimms, true);
+    g_free(b->socket_cores);
+    for (i = 0; i < ARRAY_SIZE(b->staged_opts); i++) {
+        qemu_opts_del(b->staged_opts[i]);
+    }
+    for (i = 0; i < SMBIOS_PART__MAX; i++) {
+        if (b->parts[i].data) {
+            g_byte_array_unref(b->parts[i].data);
+            g_byte_array_unref(b->parts[i].env);
+            g_array_free(b->parts[i].handles, true);
+        }
+    }
+    if (b->handle_map) {
+        g_hash_table_destroy(b->handle_map);
+    }
+    if (b->str_lens) {
+        g_hash_table_destroy(b->str_lens);
+    }
+    error_free(b->handle_err);
+    if (b->usr_blobs_index) {
+        g_hash_table_destroy(b->usr_blobs_index);
+    }
+
+    QTAILQ_FOREACH_SAFE(t8, &b->type8, next, t8_next) {
+        g_free(t8);
+    }
+    QTAILQ_FOREACH_SAFE(t9, &b->type9, next, t9_next) {
+        g_free(t9);
+    }
+    QTAILQ_FOREACH_SAFE(t41, &b->type41, next, t41_next) {
+        g_free(t41);
+    }
+    for (i = 0; i < b->type11.nvalues; i++) {
+        g_free(b->type11.values[i]);
+    }
+    g_free(b->type11.values);
+
+    if (b->vmstate_registered) {
+        vmstate_unregister(NULL, &vmstate_smbios, b);
+    }
+    if (b->vm_state_entry) {
+        qemu_del_vm_change_state_handler(b->vm_state_entry);
+    }
+    if (b->reset_registered) {
+        qemu_unregister_reset(smbios_reset, b);
+    }
+    if (b->share_exit.notify) {
+        qemu_remove_exit_notifier(&b->share_exit);
+    }
+    g_free(b->rebuild_mem);
+    g_free(b->mig_tables);
+    smbios_tables_free(b);
+    g_free(b->usr_blobs);
+    g_free(b->cache_dir);
+    g_free(b->share_dir);
+    g_free(b);
+}
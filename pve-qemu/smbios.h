@@ -336,8 +336,16 @@ struct smbios_type_7 {
 	uint8_t error_correction;
 	uint8_t system_cache_type;
 	uint8_t associativity;
+	/* SMBIOS 3.1, sizes above 2047M */
+	uint32_t max_cache_size2;
+	uint32_t installed_size2;
 } QEMU_PACKED;
 
+typedef enum smbios_type_7_len_ver {
+    SMBIOS_TYPE_7_LEN_V21 = offsetofend(struct smbios_type_7, associativity),
+    SMBIOS_TYPE_7_LEN_V31 = offsetofend(struct smbios_type_7, installed_size2),
+} smbios_type_7_len_ver;
+
 /* SMBIOS type 20 MemoryDeviceMappedAddress 内存设备映射地址信息 小迪 sec666 added */
 //https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 20 内部参数信息
 struct smbios_type_20 {
@@ -349,8 +357,18 @@ struct smbios_type_20 {
 	uint8_t partition_row_position;
 	uint8_t interleave_position;
 	uint8_t interleave_data_depth;
+	/* SMBIOS spec 2.7+ */
+	uint64_t extended_starting_address;
+	uint64_t extended_ending_address;
 } QEMU_PACKED;
 
+typedef enum smbios_type_20_len_ver {
+    SMBIOS_TYPE_20_LEN_V21 = offsetofend(struct smbios_type_20,
+                                         interleave_data_depth),
+    SMBIOS_TYPE_20_LEN_V27 = offsetofend(struct smbios_type_20,
+                                         extended_ending_address),
+} smbios_type_20_len_ver;
+
 /* SMBIOS type 26 VoltageProbe 电压传感器设备信息 小迪 sec666 added*/
 //https://www.dmtf.org/sites/default/files/standards/documents/DSP0134_3.8.0WIP50.pdf 请使用这个规范文件System Management BIOS (SMBIOS) Reference Specification设置type 26 内部参数信息
 struct smbios_type_26 {
@@ -427,6 +445,12 @@ struct smbios_type_127 {
     struct smbios_structure_header header;
 } QEMU_PACKED;
 
+/*
+ * Size of the structure at @p, string-set and its terminator included,
+ * reading at most @max_len bytes
+ */
+size_t smbios_structure_size(const uint8_t *p, size_t max_len);
+
 bool smbios_validate_table(SmbiosEntryPointType ep_type, Error **errp);
 void smbios_add_usr_blob_size(size_t size);
 void smbios_entry_add(QemuOpts *opts, Error **errp);
@@ -443,4 +467,65 @@ void smbios_get_tables(MachineState *ms,
                        uint8_t **tables, size_t *tables_len,
                        uint8_t **anchor, size_t *anchor_len,
                        Error **errp);
+
+/* What the last smbios_get_tables() call cost, for benchmarking it */
+typedef struct SmbiosBuildStats {
+    int64_t build_us;       /* wall time, in microseconds */
+    unsigned allocs;        /* (re)allocations of the table blob */
+    size_t peak_size;       /* largest table blob allocated */
+    size_t tables_len;      /* size of the generated tables */
+    unsigned structures;
+    unsigned reused;        /* structures copied from the previous build */
+    bool cache_hit;         /* tables were loaded from the cache */
+    bool shared;            /* tables map the host-wide copy */
+    SmbiosEntryPointType ep_type;   /* the one built, never AUTO */
+    bool auto_fallback;     /* AUTO did not fit 2.1 and picked 3.0 */
+} SmbiosBuildStats;
+
+void smbios_get_build_stats(SmbiosBuildStats *stats);
+
+/*
+ * fw_cfg select callback of etc/smbios/smbios-tables, refreshes the bus
+ * numbers of devices behind PCI bridges.
+ */
+void smbios_fw_cfg_select(void *opaque);
+
+/*
+ * Board hotplug hooks, called once @dev is plugged into the machine and
+ * as it is unplugged. CPUs and DIMMs change the tables the firmware gets
+ * after the next system reset.
+ */
+void smbios_device_plug(DeviceState *dev);
+void smbios_device_unplug(DeviceState *dev);
+
+/*
+ * The functions above build the tables of the machine QEMU runs. An
+ * SmbiosBuilder builds the tables of any machine, independently of all
+ * others: tools can build many in parallel, one thread per builder.
+ * Strings passed in through QemuOpts must outlive the builder. Tables
+ * returned by smbios_builder_get_tables() belong to the builder and stay
+ * valid until its next build.
+ */
+typedef struct SmbiosBuilder SmbiosBuilder;
+
+SmbiosBuilder *smbios_builder_new(void);
+void smbios_builder_free(SmbiosBuilder *b);
+void smbios_builder_entry_add(SmbiosBuilder *b, QemuOpts *opts,
+                              Error **errp);
+void smbios_builder_set_cpuid(SmbiosBuilder *b,
+                              uint32_t version, uint32_t features);
+void smbios_builder_set_defaults(SmbiosBuilder *b, const char *manufacturer,
+                                 const char *product, const char *version,
+                                 bool uuid_encoded);
+void smbios_builder_set_default_processor_family(SmbiosBuilder *b,
+                                                 uint16_t processor_family);
+bool smbios_builder_get_tables(SmbiosBuilder *b, MachineState *ms,
+                               SmbiosEntryPointType ep_type,
+                               const struct smbios_phys_mem_area *mem_array,
+                               const unsigned int mem_array_size,
+                               uint8_t **tables, size_t *tables_len,
+                               uint8_t **anchor, size_t *anchor_len,
+                               Error **errp);
+void smbios_builder_get_build_stats(SmbiosBuilder *b,
+                                    SmbiosBuildStats *stats);
 #endif /* QEMU_SMBIOS_H */
@@ -0,0 +1,150 @@
+/*
+ * SMBIOS Support
+ *
+ * Copyright (C) 2009 Hewlett-Packard Development Company, L.P.
+ * Copyright (C) 2013 Red Hat, Inc.
+ *
+ * Authors:
+ *  Alex Williamson <alex.williamson@hp.com>
+ *  Markus Armbruster <armbru@redhat.com>
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2.  See
+ * the COPYING file in the top-level directory.
+ *
+ * Contributions after 2012-01-13 are licensed under the terms of the
+ * GNU GPL, version 2 or (at your option) any later version.
+ */
+
+#ifndef QEMU_SMBIOS_BUILD_H
+#define QEMU_SMBIOS_BUILD_H
+
+/* The tables an SmbiosBuilder is building */
+typedef struct SmbiosTables {
+    uint8_t *data;
+    size_t len;
+    size_t size;        /* allocated */
+    unsigned max;       /* size of the largest structure */
+    unsigned cnt;       /* number of structures */
+} SmbiosTables;
+
+/*
+ * The tables being built by this thread, set for the duration of a
+ * build. The helpers and macros below, and the structure builders
+ * outside smbios.c, add to these.
+ */
+extern __thread SmbiosTables *smbios_tables;
+
+bool smbios_skip_table(uint8_t type, bool required_table);
+
+/*
+ * Make room for @len more bytes at the end of smbios_tables and return
+ * a pointer to them. The buffer grows geometrically, so building a
+ * table set costs a handful of allocations however many structures it
+ * holds. The buffer may move, so pointers into it must be recomputed
+ * from their offset after every call.
+ */
+uint8_t *smbios_tables_reserve(size_t len);
+
+/*
+ * strlen(@str), reusing the length measured earlier in the build when
+ * @str is one of the builder's option strings.
+ */
+size_t smbios_tables_strlen(const char *str);
+
+/*
+ * Trace and account the structure at offset @t_off, the @instance'th of
+ * its type: begin before its space is reserved, end once its string-set
+ * is terminated.
+ */
+void smbios_table_begin(uint8_t type, unsigned instance, uint16_t handle);
+void smbios_table_end(size_t t_off, unsigned instance);
+
+#define SMBIOS_BUILD_TABLE_PRE_SIZE(tbl_type, tbl_handle, tbl_instance,   \
+                                    tbl_required, tbl_len)                \
+    struct smbios_type_##tbl_type *t;                                     \
+    size_t t_off; /* table offset into smbios_tables */                   \
+    int str_index = 0;                                                    \
+    unsigned t_instance = (tbl_instance); /* for tracing */               \
+    do {                                                                  \
+        uint16_t t_handle;                                                \
+                                                                          \
+        /* should we skip building this table ? */                        \
+        if (smbios_skip_table(tbl_type, tbl_required)) {                  \
+            return;                                                       \
+        }                                                                 \
+        t_handle = (tbl_handle);                                          \
+        smbios_table_begin(tbl_type, t_instance, t_handle);               \
+                                                                          \
+        /* use offset of table t within smbios_tables */                  \
+        /* (pointer must be updated after each reserve) */                \
+        t_off = smbios_tables->len;                                       \
+        t = (struct smbios_type_##tbl_type *)                             \
+            smbios_tables_reserve(tbl_len);                               \
+        memset(t, 0, tbl_len);                                            \
+        smbios_tables->len += tbl_len;                                    \
+                                                                          \
+        t->header.type = tbl_type;                                        \
+        t->header.length = tbl_len;                                       \
+        t->header.handle = cpu_to_le16(t_handle);                         \
+    } while (0)
+
+#define SMBIOS_BUILD_TABLE_PRE(tbl_type, tbl_handle, tbl_instance,       \
+                               tbl_required)                              \
+    SMBIOS_BUILD_TABLE_PRE_SIZE(tbl_type, tbl_handle, tbl_instance,       \
+                                tbl_required,                             \
+                                sizeof(struct smbios_type_##tbl_type))\
+
+#define SMBIOS_TABLE_SET_STR(tbl_type, field, value)                      \
+    do {                                                                  \
+        int len = (value != NULL) ?                                       \
+                  smbios_tables_strlen(value) + 1 : 0;                    \
+        if (len > 1) {                                                    \
+            memcpy(smbios_tables_reserve(len), value, len);               \
+            smbios_tables->len += len;                                    \
+            /* update pointer post-reserve */                             \
+            t = (struct smbios_type_##tbl_type *)                         \
+                (smbios_tables->data + t_off);                            \
+            t->field = ++str_index;                                       \
+        } else {                                                          \
+            t->field = 0;                                                 \
+        }                                                                 \
+    } while (0)
+
+#define SMBIOS_TABLE_SET_STR_LIST(tbl_type, value)                        \
+    do {                                                                  \
+        int len = (value != NULL) ?                                       \
+                  smbios_tables_strlen(value) + 1 : 0;                    \
+        if (len > 1) {                                                    \
+            memcpy(smbios_tables_reserve(len), value, len);               \
+            smbios_tables->len += len;                                    \
+            /* update pointer post-reserve */                             \
+            t = (struct smbios_type_##tbl_type *)                         \
+                (smbios_tables->data + t_off);                            \
+            ++str_index;                                                  \
+        }                                                                 \
+    } while (0)
+
+#define SMBIOS_BUILD_TABLE_POST                                           \
+    do {                                                                  \
+        size_t term_cnt, t_size;                                          \
+                                                                          \
+        /* add '\0' terminator (add two if no strings defined) */         \
+        term_cnt = (str_index == 0) ? 2 : 1;                              \
+        memset(smbios_tables_reserve(term_cnt), 0, term_cnt);             \
+        smbios_tables->len += term_cnt;                                   \
+                                                                          \
+        /* update smbios max. element size */                             \
+        t_size = smbios_tables->len - t_off;                              \
+        if (t_size > smbios_tables->max) {                                \
+            smbios_tables->max = t_size;                                  \
+        }                                                                 \
+                                                                          \
+        /* update smbios element count */                                 \
+        smbios_tables->cnt++;                                             \
+        smbios_table_end(t_off, t_instance);                              \
+    } while (0)
+
+/* IPMI SMBIOS firmware handling */
+void smbios_build_type_38_table(void);
+
+#endif /* QEMU_SMBIOS_BUILD_H */